@@ -4,7 +4,27 @@
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <algorithm>
+#include <deque>
+#include <atomic>
+#include <new>
+#include <thread>
 #include <regex>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <cstdio>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#define NO_MMAP//checkpoints are read into memory instead of being mapped
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 /*
 Author: Zackary Finer
 
@@ -160,38 +180,313 @@ struct memsafe_data_entry {
 
 #define DEFUALT_STACK_SIZE 256
 #define DEFAULT_HEAP_SIZE 2048*8 // 16,384 or 2^14 or
-//we will be inserting padding between the stack, dynamic, and data regions to compensate for any expansions of these regions that may occur during runtime
-#define TEXT_START 0x1
-#define BSS_START 0xffff
-#define DATA_START 0x1fffe
-#define DYNAMIC_START 0x3fffc
-#define STACK_START 0x8001fffd
+
+typedef unsigned long long vaddr_t;//simulated (local) addresses, wide enough for the 64 bit layouts below
+enum Region {
+	R_NULL,//ordered by start address, so a layout can compute the region by counting (or shifting) instead of walking a chain of ifs
+	R_TEXT,
+	R_BSS,
+	R_DATA,
+	R_DYNAMIC,
+	R_STACK,
+	R_COUNT
+};
+/*
+Memory layouts are described by policy types. Each layout provides the start of every region, the sizes of the stack and heap, which way the stack grows,
+and a regionOf() function mapping an address to a Region. AddressSpace::accessIn is instantiated per layout, so for the static layouts below the region
+dispatch is a handful of compares (or one shift) feeding a switch, with no runtime chain of branches.
+*/
+struct ClassicLayout {
+	//the original layout: we will be inserting padding between the stack, dynamic, and data regions to compensate for any expansions of these regions that may occur during runtime
+	static constexpr vaddr_t TEXT_START = 0x1;
+	static constexpr vaddr_t BSS_START = 0xffff;
+	static constexpr vaddr_t DATA_START = 0x1fffe;
+	static constexpr vaddr_t DYNAMIC_START = 0x3fffc;
+	static constexpr vaddr_t STACK_START = 0x8001fffd;
+	static constexpr vaddr_t STACK_END = 0x100000000;//one past the last stack address
+	static constexpr int STACK_SIZE = DEFUALT_STACK_SIZE;
+	static constexpr int HEAP_SIZE = DEFAULT_HEAP_SIZE;
+	static constexpr bool STACK_GROWS_DOWN = false;
+	static inline int regionOf(vaddr_t a) {
+		//the region boundaries aren't aligned, but since the regions are ordered we can just count how many starts lie at or below the address
+		return (a >= TEXT_START) + (a >= BSS_START) + (a >= DATA_START) + (a >= DYNAMIC_START) + (a >= STACK_START);
+	}
+};
+template<unsigned SHIFT, int STACK, int HEAP, bool DOWN>
+struct AlignedLayout {
+	//every region starts on a multiple of 2^SHIFT, in Region order, so the region is simply the top bits of the address
+	static constexpr vaddr_t TEXT_START = (vaddr_t)R_TEXT << SHIFT;
+	static constexpr vaddr_t BSS_START = (vaddr_t)R_BSS << SHIFT;
+	static constexpr vaddr_t DATA_START = (vaddr_t)R_DATA << SHIFT;
+	static constexpr vaddr_t DYNAMIC_START = (vaddr_t)R_DYNAMIC << SHIFT;
+	static constexpr vaddr_t STACK_START = (vaddr_t)R_STACK << SHIFT;
+	static constexpr vaddr_t STACK_END = (vaddr_t)R_COUNT << SHIFT;
+	static constexpr int STACK_SIZE = STACK;
+	static constexpr int HEAP_SIZE = HEAP;
+	static constexpr bool STACK_GROWS_DOWN = DOWN;
+	static inline int regionOf(vaddr_t a) {
+		vaddr_t r = a >> SHIFT;
+		return r < R_COUNT ? (int)r : R_NULL;
+	}
+};
+typedef AlignedLayout<28, DEFUALT_STACK_SIZE, DEFAULT_HEAP_SIZE, true> Layout32;//256 MB regions in a 32 bit address space
+typedef AlignedLayout<40, 4096, 1 << 20, true> Layout64;//1 TB regions, with a larger stack and heap
+
+struct RuntimeLayout {
+	//same shape as the layouts above, but the values are only known at runtime (useful for experimenting with layouts without recompiling)
+	vaddr_t TEXT_START, BSS_START, DATA_START, DYNAMIC_START, STACK_START, STACK_END;
+	int STACK_SIZE, HEAP_SIZE;
+	bool STACK_GROWS_DOWN;
+	template<class L>
+	static RuntimeLayout of() {
+		RuntimeLayout r;
+		r.TEXT_START = L::TEXT_START;
+		r.BSS_START = L::BSS_START;
+		r.DATA_START = L::DATA_START;
+		r.DYNAMIC_START = L::DYNAMIC_START;
+		r.STACK_START = L::STACK_START;
+		r.STACK_END = L::STACK_END;
+		r.STACK_SIZE = L::STACK_SIZE;
+		r.HEAP_SIZE = L::HEAP_SIZE;
+		r.STACK_GROWS_DOWN = L::STACK_GROWS_DOWN;
+		return r;
+	}
+	inline int regionOf(vaddr_t a) const {
+		return (a >= TEXT_START) + (a >= BSS_START) + (a >= DATA_START) + (a >= DYNAMIC_START) + (a >= STACK_START && a < STACK_END);
+	}
+	bool sameAs(const RuntimeLayout& other) const {
+		return TEXT_START == other.TEXT_START && BSS_START == other.BSS_START && DATA_START == other.DATA_START && DYNAMIC_START == other.DYNAMIC_START
+			&& STACK_START == other.STACK_START && STACK_END == other.STACK_END && STACK_SIZE == other.STACK_SIZE && HEAP_SIZE == other.HEAP_SIZE
+			&& STACK_GROWS_DOWN == other.STACK_GROWS_DOWN;
+	}
+	vaddr_t stackAddress(int slot) const {
+		return STACK_GROWS_DOWN ? STACK_END - 1 - slot : STACK_START + slot;
+	}
+	bool ordered() const {
+		//regions in Region order, with the heap and stack fitting before whatever comes next
+		return TEXT_START > 0 && TEXT_START < BSS_START && BSS_START < DATA_START && DATA_START < DYNAMIC_START && DYNAMIC_START < STACK_START
+			&& STACK_START < STACK_END && HEAP_SIZE > 0 && (vaddr_t)HEAP_SIZE <= STACK_START - DYNAMIC_START
+			&& STACK_SIZE > 0 && (vaddr_t)STACK_SIZE <= STACK_END - STACK_START;
+	}
+};
+
+/*
+Simulated physical memory, shared by every AddressSpace. The heap and stack regions no longer own a private array: they keep a table of frames and take
+a frame from the pool the first time a page is touched, charging it to the owning process's FrameAccount. Frames go back to the pool when a region
+releases them or when the process is destroyed.
+Free frames are kept on a lock-free stack (the head carries a tag, so a frame popped and pushed back between a load and a CAS can't fool it), and each
+thread keeps a small cache of frames in front of it, so most allocations and frees never touch the shared head.
+*/
+#define FRAME_SHIFT 12//4 KB frames
+#define FRAME_SIZE (1 << FRAME_SHIFT)
+#define FRAME_CACHE_SIZE 32
+#define DEFAULT_POOL_FRAMES 65536//256 MB of simulated physical memory, only backed by the host as it's used
+struct FrameAccount {
+	//per process accounting, quota is in frames (-1 for no limit)
+	int quota;
+	std::atomic<int> used;
+	std::atomic<int> peak;
+	std::atomic<int> denied;
+	FrameAccount(int _quota = -1) : quota(_quota), used(0), peak(0), denied(0) {}
+	bool charge(bool force = false) {
+		//forced charges (the allocator's own bookkeeping) always go through, but still count towards the quota
+		int now = used.fetch_add(1, std::memory_order_relaxed) + 1;
+		if (!force && quota >= 0 && now > quota)
+		{
+			used.fetch_sub(1, std::memory_order_relaxed);
+			denied.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		int high = peak.load(std::memory_order_relaxed);
+		while (now > high && !peak.compare_exchange_weak(high, now, std::memory_order_relaxed));
+		return true;
+	}
+	void refund(int frames) {
+		used.fetch_sub(frames, std::memory_order_relaxed);
+	}
+};
+class FramePool {
+	char* m_memory;
+	int m_frame_count;
+	std::atomic<int>* m_next;//next free frame below each free frame, -1 at the bottom
+	std::atomic<unsigned long long> m_head;//(tag << 32) | (top frame + 1), 0 when empty
+	std::atomic<int> m_free_count;//frames on the shared stack (thread caches not included)
+	struct FrameCache {
+		FramePool* pool = nullptr;
+		int frames[FRAME_CACHE_SIZE];
+		int count = 0;
+		~FrameCache() {
+			if (pool != nullptr)
+				pool->pushChain(frames, count);
+		}
+	};
+	static FrameCache& cache() {
+		static thread_local FrameCache c;
+		return c;
+	}
+	FrameCache& cacheFor() {
+		//the thread's cache belongs to one pool at a time, switching pools hands the cached frames back first
+		FrameCache& c = cache();
+		if (c.pool != this)
+		{
+			if (c.pool != nullptr)
+				c.pool->pushChain(c.frames, c.count);
+			c.pool = this;
+			c.count = 0;
+		}
+		return c;
+	}
+	int pop() {
+		unsigned long long head = m_head.load(std::memory_order_acquire);
+		while (true)
+		{
+			int top = (int)(head & 0xffffffffu) - 1;
+			if (top < 0)
+				return -1;
+			int next = m_next[top].load(std::memory_order_relaxed);
+			unsigned long long swapped = (((head >> 32) + 1) << 32) | (unsigned int)(next + 1);
+			if (m_head.compare_exchange_weak(head, swapped, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				m_free_count.fetch_sub(1, std::memory_order_relaxed);
+				return top;
+			}
+		}
+	}
+	void pushChain(const int* frames, int count) {
+		//links the frames together and publishes them with a single CAS
+		if (count <= 0)
+			return;
+		for (int i = 0; i + 1 < count; i++)
+			m_next[frames[i]].store(frames[i + 1], std::memory_order_relaxed);
+		unsigned long long head = m_head.load(std::memory_order_acquire);
+		unsigned long long swapped;
+		do {
+			m_next[frames[count - 1]].store((int)(head & 0xffffffffu) - 1, std::memory_order_relaxed);
+			swapped = (((head >> 32) + 1) << 32) | (unsigned int)(frames[0] + 1);
+		} while (!m_head.compare_exchange_weak(head, swapped, std::memory_order_acq_rel, std::memory_order_acquire));
+		m_free_count.fetch_add(count, std::memory_order_relaxed);
+	}
+public:
+	FramePool(int frames = DEFAULT_POOL_FRAMES) {
+		m_frame_count = frames;
+		m_memory = new char[(size_t)frames << FRAME_SHIFT];
+		m_next = new std::atomic<int>[frames];
+		m_head.store(0);
+		m_free_count.store(0);
+		std::vector<int> all(frames);
+		for (int i = 0; i < frames; i++)
+			all[i] = i;
+		pushChain(all.data(), frames);
+	}
+	static FramePool& global() {
+		static FramePool pool;
+		return pool;
+	}
+	char* frameData(int frame) { return m_memory + ((size_t)frame << FRAME_SHIFT); }
+	int getFrameCount() { return m_frame_count; }
+	int getFreeCount() { return m_free_count.load(std::memory_order_relaxed); }
+	int allocateFrame(FrameAccount* account, bool force = false) {
+		//returns -1 if the process is over its quota (unless forced) or the pool is empty
+		if (!account->charge(force))
+			return -1;
+		FrameCache& c = cacheFor();
+		if (c.count == 0)
+		{
+			//refill half the cache, so alternating allocate/free doesn't bounce on the shared stack
+			for (int f; c.count < FRAME_CACHE_SIZE / 2 && (f = pop()) != -1;)
+				c.frames[c.count++] = f;
+			if (c.count == 0)
+			{
+				account->refund(1);
+				return -1;
+			}
+		}
+		return c.frames[--c.count];
+	}
+	void freeFrame(int frame, FrameAccount* account) {
+		FrameCache& c = cacheFor();
+		if (c.count == FRAME_CACHE_SIZE)
+		{
+			pushChain(c.frames + FRAME_CACHE_SIZE / 2, FRAME_CACHE_SIZE / 2);
+			c.count = FRAME_CACHE_SIZE / 2;
+		}
+		c.frames[c.count++] = frame;
+		account->refund(1);
+	}
+	void freeFrames(const std::vector<int>& frames, FrameAccount* account) {
+		//bulk reclaim (a region or process going away): skips the cache and returns everything in one CAS
+		std::vector<int> live;
+		for (int f : frames)
+			if (f != -1)
+				live.push_back(f);
+		pushChain(live.data(), (int)live.size());
+		account->refund((int)live.size());
+	}
+	~FramePool() {
+		if (cache().pool == this)
+			cache().pool = nullptr;//only this thread's cache can still point here, other threads flushed theirs on exit
+		delete[] m_memory;
+		delete[] m_next;
+	}
+};
 
 class MemStack {
-	memsafe_data_entry* m_data;
+	memsafe_data_entry* m_data;//contiguous entries, when the stack isn't backed by frames
+	std::vector<int> m_frames;//otherwise the frame holding each page of entries, -1 until that page is first used
+	FrameAccount* m_account;
 	int m_head;
 	int m_max_Size;
+	static const int ENTRIES_PER_FRAME = FRAME_SIZE / sizeof(memsafe_data_entry);
+	memsafe_data_entry* entryAt(int index) {
+		if (m_account == nullptr)
+			return m_data + index;
+		int& frame = m_frames[index / ENTRIES_PER_FRAME];
+		if (frame == -1)
+		{
+			frame = FramePool::global().allocateFrame(m_account);
+			if (frame == -1)
+				return nullptr;
+			memsafe_data_entry* page = (memsafe_data_entry*)FramePool::global().frameData(frame);
+			for (int i = 0; i < ENTRIES_PER_FRAME; i++)
+				new (page + i) memsafe_data_entry();
+		}
+		return (memsafe_data_entry*)FramePool::global().frameData(frame) + index % ENTRIES_PER_FRAME;
+	}
 public:
 	int getMax() { return m_max_Size; }
-	MemStack(int size = DEFUALT_STACK_SIZE) {
+	int getCount() { return m_head + 1; }
+	MemStack(int size = DEFUALT_STACK_SIZE, FrameAccount* account = nullptr) {
 		m_max_Size = size;
-		m_data = new memsafe_data_entry[m_max_Size];
+		m_account = account;
+		if (m_account == nullptr)
+			m_data = new memsafe_data_entry[m_max_Size];
+		else
+			m_frames.assign((m_max_Size + ENTRIES_PER_FRAME - 1) / ENTRIES_PER_FRAME, -1);
 		m_head = -1;
 	}
 	memsafe_data_entry& operator[](int index) {
 		if (index <= m_head)
 		{
-			return m_data[index];//i think data + index would also work, although this makes me uncomfortable
+			return *entryAt(index);
 		}
 		std::cerr << "ERROR, INDEX OUT OF BOUNDS OF STACK\n";
 	}
 
-	void push(const data_entry & entry) {
+	bool push(const data_entry & entry) {
+		//false if nothing was pushed
 		if (m_head < m_max_Size - 1) {
-			m_data[++m_head] = entry;
-			return;
+			memsafe_data_entry* slot = entryAt(m_head + 1);
+			if (slot == nullptr)
+			{
+				std::cerr << "ERROR, STACK FRAME QUOTA EXCEEDED\n";
+				return false;
+			}
+			*slot = entry;
+			m_head++;
+			return true;
 		}
 		std::cerr << "ERROR, STACK OVERFLOW\n";
+		return false;
 	}
 
 	void pop() {
@@ -204,16 +499,377 @@ public:
 	}
 	memsafe_data_entry& peek() {
 		if (m_head >= 0)
-			return m_data[m_head];
+			return *entryAt(m_head);
 		std::cerr << "ERROR, STACK UNDERFLOW\n";
 	}
 	~MemStack()
 	{
-		delete[] m_data;//when the stack is deleted, de-allocate everything within it
+		if (m_account == nullptr)
+		{
+			delete[] m_data;//when the stack is deleted, de-allocate everything within it
+			return;
+		}
+		for (int frame : m_frames)
+		{
+			if (frame == -1)
+				continue;
+			memsafe_data_entry* page = (memsafe_data_entry*)FramePool::global().frameData(frame);
+			for (int i = 0; i < ENTRIES_PER_FRAME; i++)
+				page[i].~memsafe_data_entry();
+		}
+		FramePool::global().freeFrames(m_frames, m_account);
 	}
 };
 
-class DynamicRegion {
+/*
+Helpers for writing checkpoints. Everything is appended to one buffer (written out in a single call) and read back by walking a pointer through the mapped file.
+Values are stored in native byte order, checkpoints are not meant to move between machines.
+The read* versions take the end of the metadata and return false instead of reading past it, since the file may have been cut short or tampered with.
+*/
+template<class T>
+void putRaw(std::string& out, const T& value)
+{
+	out.append((const char*)&value, sizeof(T));
+}
+template<class T>
+T getRaw(const char*& in)
+{
+	T value;
+	memcpy(&value, in, sizeof(T));
+	in += sizeof(T);
+	return value;
+}
+void putString(std::string& out, const std::string& value)
+{
+	putRaw(out, (int)value.size());
+	out.append(value);
+}
+template<class T>
+bool readRaw(const char*& in, const char* end, T& value)
+{
+	if (end - in < (std::ptrdiff_t)sizeof(T))
+		return false;
+	value = getRaw<T>(in);
+	return true;
+}
+bool readString(const char*& in, const char* end, std::string& value)
+{
+	int size;
+	if (!readRaw(in, end, size) || size < 0 || end - in < size)
+		return false;
+	value.assign(in, size);
+	in += size;
+	return true;
+}
+void putEntry(std::string& out, DataType type, void* data)
+{
+	putRaw(out, (int)(data == nullptr ? T_VOID : type));
+	if (data == nullptr)
+		return;
+	switch (type)
+	{
+	case T_FL:
+		putRaw(out, *(float*)data);
+		break;
+	case T_INT:
+		putRaw(out, *(int*)data);
+		break;
+	case T_CH:
+	case T_BYTE:
+		putRaw(out, *(char*)data);
+		break;
+	case T_STR:
+		putString(out, *(std::string*)data);
+		break;
+	default:
+		break;
+	}
+}
+bool readEntry(const char*& in, const char* end, data_entry& entry)
+{
+	//allocates the value the same way DataLoader::buildDataEntry does
+	int type;
+	if (!readRaw(in, end, type))
+		return false;
+	switch (type)
+	{
+	case T_FL:
+	{
+		float value;
+		if (!readRaw(in, end, value))
+			return false;
+		entry = data_entry(new float(value), T_FL);
+		return true;
+	}
+	case T_INT:
+	{
+		int value;
+		if (!readRaw(in, end, value))
+			return false;
+		entry = data_entry(new int(value), T_INT);
+		return true;
+	}
+	case T_CH:
+	{
+		char value;
+		if (!readRaw(in, end, value))
+			return false;
+		entry = data_entry(new char(value), T_CH);
+		return true;
+	}
+	case T_BYTE:
+	{
+		unsigned char value;
+		if (!readRaw(in, end, value))
+			return false;
+		entry = data_entry(new unsigned char(value), T_BYTE);
+		return true;
+	}
+	case T_STR:
+	{
+		std::string value;
+		if (!readString(in, end, value))
+			return false;
+		entry = data_entry(new std::string(value), T_STR);
+		return true;
+	}
+	case T_VOID:
+		entry = data_entry(nullptr, T_VOID);
+		return true;
+	default:
+		return false;
+	}
+}
+bool readEntries(const char*& in, const char* end, int count, std::vector<data_entry>& entries)
+{
+	//count entries followed by a T_VOID tail. what was read before a failure is left in entries, so the caller can free it
+	if (count < 0 || count > (end - in) / (int)sizeof(int))
+		return false;
+	entries.reserve(count + 1);
+	for (int i = 0; i < count; i++)
+	{
+		data_entry entry;
+		if (!readEntry(in, end, entry))
+			return false;
+		entries.push_back(entry);
+	}
+	entries.push_back(data_entry(nullptr, T_VOID));
+	return true;
+}
+
+struct BlockBits {
+	//a bit per possible block start, for engines whose free blocks don't carry a header of their own to check a free against
+	std::vector<unsigned long long> words;
+	void reset(int units) { words.assign((units + 63) >> 6, 0); }
+	bool get(int unit) { return (words[unit >> 6] >> (unit & 63)) & 1; }
+	void set(int unit, bool value) {
+		if (value)
+			words[unit >> 6] |= 1ull << (unit & 63);
+		else
+			words[unit >> 6] &= ~(1ull << (unit & 63));
+	}
+	void clearBelow(int units) { std::fill(words.begin(), words.begin() + ((units + 63) >> 6), 0ull); }
+	void save(std::string& out) { out.append((const char*)words.data(), sizeof(unsigned long long) * words.size()); }
+	bool load(const char*& in, const char* end) {
+		if ((size_t)(end - in) < sizeof(unsigned long long) * words.size())
+			return false;
+		memcpy(words.data(), in, sizeof(unsigned long long) * words.size());
+		in += sizeof(unsigned long long) * words.size();
+		return true;
+	}
+};
+/*
+Interface for the allocator behind the dynamic region, so each process can pick an engine at construction.
+Every engine works on offsets into its own data region, and writes the requested size as an int at the offset it returns (printAddressSpaceInfo relies on this).
+*/
+class HeapAllocator {
+protected:
+	char* m_dataRegion;//contiguous backing (owned, or adopted from a checkpoint), or nullptr when the region is backed by frames from the pool
+	int m_region_size;
+	std::vector<int> m_frames;//frame for each page of the region, -1 until the page is first touched
+	FrameAccount* m_account;
+	static char* zeroFrame() {
+		//what reads of a page that was never written see, if it can't be committed
+		static char frame[FRAME_SIZE];
+		return frame;
+	}
+	bool commit(int page, bool force) {
+		int& frame = m_frames[page];
+		if (frame != -1)
+			return true;
+		if ((frame = FramePool::global().allocateFrame(m_account, force)) == -1)
+		{
+			std::cerr << (force ? "ERROR: OUT OF PHYSICAL FRAMES\n" : "ERROR: FRAME QUOTA EXCEEDED\n");
+			return false;
+		}
+		memset(FramePool::global().frameData(frame), 0, FRAME_SIZE);//the frame may still hold another process's data, and the page has to read the same as it did through zeroFrame
+		return true;
+	}
+	bool commitRange(int index, int amnt) {
+		//engines call this before writing headers or links anywhere that might not be paged in yet, and give up (returning -1) if it fails.
+		//these pages are committed even past the quota, since the engine's bookkeeping can't be left half written
+		if (m_dataRegion != nullptr)
+			return true;
+		for (int page = index >> FRAME_SHIFT; page <= (index + amnt - 1) >> FRAME_SHIFT; page++)
+			if (m_frames[page] == -1 && !commit(page, true))
+				return false;
+		return true;
+	}
+	inline char* byteAt(int index) {
+		//engines must go through this (or intAt/copyBytes) rather than doing arithmetic on a region pointer, since pages aren't contiguous.
+		//every write site has been through commitRange, so an uncommitted page here is only ever read
+		if (m_dataRegion != nullptr)
+			return m_dataRegion + index;
+		int page = index >> FRAME_SHIFT;
+		if (m_frames[page] == -1)
+			return zeroFrame() + (index & (FRAME_SIZE - 1));
+		return FramePool::global().frameData(m_frames[page]) + (index & (FRAME_SIZE - 1));
+	}
+	inline int& intAt(int index) {
+		return *(int*)byteAt(index);//headers and links are at least 4 byte aligned, so they never straddle a page
+	}
+	bool copyBytes(int dst, int src, int amnt) {
+		//false (with nothing copied) if the destination can't be paged in
+		if (!commitRange(dst, amnt))
+			return false;
+		while (amnt > 0)
+		{
+			int chunk = amnt;
+			chunk = chunk < FRAME_SIZE - (dst & (FRAME_SIZE - 1)) ? chunk : FRAME_SIZE - (dst & (FRAME_SIZE - 1));
+			chunk = chunk < FRAME_SIZE - (src & (FRAME_SIZE - 1)) ? chunk : FRAME_SIZE - (src & (FRAME_SIZE - 1));
+			memmove(byteAt(dst), byteAt(src), chunk);
+			dst += chunk;
+			src += chunk;
+			amnt -= chunk;
+		}
+		return true;
+	}
+	void releaseRange(int index, int amnt) {
+		//hands back the frames of every page lying entirely inside a range that no longer holds anything
+		if (m_dataRegion != nullptr)
+			return;
+		for (int page = (index + FRAME_SIZE - 1) >> FRAME_SHIFT; (page + 1) << FRAME_SHIFT <= index + amnt; page++)
+		{
+			if (m_frames[page] != -1)
+			{
+				FramePool::global().freeFrame(m_frames[page], m_account);
+				m_frames[page] = -1;
+			}
+		}
+	}
+	static inline int fastlog2(int val) {
+		int lvl = 0;
+		while (val >>= 1) lvl++;//bitshift by 1, , equivalent to val /= 2, until 0. This should return the number of times it can be divided by 2
+		return lvl;
+	}
+	static inline int ctz(unsigned int val) {//index of the lowest set bit, val must not be 0
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, val);
+		return (int)index;
+#else
+		return __builtin_ctz(val);
+#endif
+	}
+	static inline int fastPow2(int val) {//returns 2 ^ val
+		return 1 << val;
+	}
+	static inline int getP2(int val) {
+		int rnd_flr = fastlog2(val);
+		return fastPow2(rnd_flr) == val ? rnd_flr : rnd_flr + 1;
+	}
+public:
+	bool m_owns_region;//false once the region has been handed over by adoptRegion
+	HeapAllocator(int _size, FrameAccount* account = nullptr) {
+		//with an account the region is paged in from the global frame pool, without one it is a private array as before
+		m_region_size = _size;
+		m_account = account;
+		if (m_account == nullptr)
+		{
+			m_dataRegion = new char[m_region_size];
+			m_owns_region = true;
+		}
+		else
+		{
+			m_dataRegion = nullptr;
+			m_owns_region = false;
+			m_frames.assign((m_region_size + FRAME_SIZE - 1) >> FRAME_SHIFT, -1);
+		}
+	}
+	void adoptRegion(char* region) {
+		//use memory owned by someone else (a mapped checkpoint) as the data region
+		if (m_owns_region)
+			delete[] m_dataRegion;
+		if (m_account != nullptr)
+			FramePool::global().freeFrames(m_frames, m_account);
+		m_frames.clear();
+		m_dataRegion = region;
+		m_owns_region = false;
+	}
+	void writeRegion(std::ostream& out) {
+		//writes the whole region in order, pages that were never touched come out as zeros
+		if (m_dataRegion != nullptr)
+		{
+			out.write(m_dataRegion, m_region_size);
+			return;
+		}
+		static const char zeros[FRAME_SIZE] = {};
+		for (size_t page = 0; page < m_frames.size(); page++)
+		{
+			int length = m_region_size - (int)(page << FRAME_SHIFT) < FRAME_SIZE ? m_region_size - (int)(page << FRAME_SHIFT) : FRAME_SIZE;
+			out.write(m_frames[page] == -1 ? zeros : FramePool::global().frameData(m_frames[page]), length);
+		}
+	}
+	int getSize() { return m_region_size; }
+	void* accessData(int index)
+	{
+		//the pointer is only good up to the end of its page. this is the process touching its memory, so the quota applies
+		if (m_dataRegion == nullptr && m_frames[index >> FRAME_SHIFT] == -1 && !commit(index >> FRAME_SHIFT, false))
+			return nullptr;
+		return byteAt(index);
+	}
+	virtual const char* getName() = 0;
+	virtual int allocate(int amnt) = 0;//returns the offset of the new block, or -1 if it couldn't be allocated
+	virtual void deallocate(int index) = 0;
+	virtual bool isAllocated(int index) = 0;//true if index is the start of a live block, i.e. something deallocate would accept
+	virtual int reallocate(int index, int amnt) {
+		//generic version: allocate a new block, copy the old contents over, then free the old block. Engines override this when they can resize in place
+		if (!isAllocated(index) || amnt <= 0)
+		{
+			std::cerr << "ERROR: INVALID REALLOCATION\n";
+			return -1;
+		}
+		int moved = allocate(amnt);
+		if (moved == -1)
+			return -1;
+		int old_amnt = intAt(index);
+		if (!copyBytes(moved, index, old_amnt < amnt ? old_amnt : amnt))
+		{
+			deallocate(moved);
+			return -1;
+		}
+		intAt(moved) = amnt;
+		deallocate(index);
+		return moved;
+	}
+	virtual std::vector<int> allocateBatch(const int* sizes, int count) {
+		//must place blocks exactly where the same sequence of allocate calls would. Engines override this when they can do it with less searching
+		std::vector<int> offsets(count);
+		for (int i = 0; i < count; i++)
+			offsets[i] = allocate(sizes[i]);
+		return offsets;
+	}
+	virtual void print_nodes() = 0;
+	virtual void saveState(std::string& out) = 0;//engine metadata only, the data region is written separately
+	virtual bool loadState(const char*& in, const char* end) = 0;//false if the metadata runs past end or doesn't fit this region, the engine should only be destroyed after that
+	virtual ~HeapAllocator() {
+		if (m_owns_region)
+			delete[] m_dataRegion;
+		if (m_account != nullptr)
+			FramePool::global().freeFrames(m_frames, m_account);
+	}
+};
+class DynamicRegion : public HeapAllocator {
 	/*
 	I decided to implement this region as a tree of nodes, connected by links.
 	A doubly linked list of nodes at each level of the tree is maintained to allow quicker memory searches
@@ -222,6 +878,7 @@ class DynamicRegion {
 	struct mem_block {
 		mem_block *parent=nullptr, *prev = nullptr, *next = nullptr, *lChild = nullptr, *rChild = nullptr;
 		bool free = true;
+		bool handle = false;//taken through allocateHandle, so only the handle functions may free or resize it
 		int index;
 		int size;
 		mem_block() { index = 0; }
@@ -233,26 +890,44 @@ class DynamicRegion {
 	};
 	mem_block** m_buddy_list;
 	int m_buddy_list_size;
-	char* m_dataRegion;
-	int m_region_size;
-	static inline int fastlog2(int val) {
-		int lvl = 0;
-		while (val >>= 1) lvl++;//bitshift by 1, , equivalent to val /= 2, until 0. This should return the number of times it can be divided by 2
-		return lvl;
-	}
-	static inline int fastPow2(int val) {//returns 2 ^ val
-		return 1 << val;
+	static const int MIN_ORDER = 2;//blocks must at least hold the int size header
+	/*
+	Handle mode: blocks allocated through allocateHandle are only reachable through the handle table, so the compactor is free to move them.
+	Blocks from allocate() are pinned where they are.
+	*/
+	std::vector<int> m_handles;//handle -> current offset, -1 for an unused handle
+	std::vector<int> m_free_handles;
+	std::vector<int> m_compact_queue;//handles still to be visited in the current compaction pass, highest offset last
+	mem_block* lowestFreeLeaf(int order)
+	{
+		//the free leaf of at least this order with the lowest address
+		mem_block* best = nullptr;
+		for (int i = order; i < m_buddy_list_size; i++)
+			for (mem_block* t = m_buddy_list[i]; t != nullptr; t = t->next)
+				if (isFree(t) && (best == nullptr || t->index < best->index))
+					best = t;
+		return best;
 	}
-	static inline int getP2(int val) {
-		int rnd_flr = fastlog2(val);
-		return fastPow2(rnd_flr) == val ? rnd_flr : rnd_flr + 1;
+	void unlink(mem_block* target)
+	{
+		//remove a block from the list for its level
+		if (target->prev != nullptr)
+			target->prev->next = target->next;
+		else
+			m_buddy_list[fastlog2(target->size)] = target->next;
+		if (target->next != nullptr)
+			target->next->prev = target->prev;
 	}
 public:
-	char* getDataRegion() { return m_dataRegion; }
-	DynamicRegion(int _size = DEFAULT_HEAP_SIZE) {
-		m_region_size = _size;
-		m_dataRegion = new char[m_region_size];
-		m_buddy_list_size = fastlog2(DEFAULT_HEAP_SIZE) + 1;
+	const char* getName() { return "BUDDY"; }
+	DynamicRegion(int _size = DEFAULT_HEAP_SIZE, FrameAccount* account = nullptr) : HeapAllocator(_size, account) {
+		if (m_region_size & (m_region_size - 1))
+		{
+			//only the largest power of 2 that fits is used, the rest of the region is left alone
+			m_region_size = fastPow2(fastlog2(m_region_size));
+			std::cerr << "ERROR: BUDDY REGION SIZE IS NOT A POWER OF 2, USING " << m_region_size << std::endl;
+		}
+		m_buddy_list_size = fastlog2(m_region_size) + 1;
 		m_buddy_list = new mem_block*[m_buddy_list_size];
 		/*
 		Fun fact (that i didn't know): new[] for pointers will initalize data to address 0xCDCDCDCD, not nullptr.
@@ -262,7 +937,7 @@ public:
 		for (int i = 0; i < m_buddy_list_size; i++)
 			m_buddy_list[i] = nullptr;
 
-		m_buddy_list[m_buddy_list_size - 1] = new mem_block(0, DEFAULT_HEAP_SIZE);//create the first entry, which will be the full size of the region
+		m_buddy_list[m_buddy_list_size - 1] = new mem_block(0, m_region_size);//create the first entry, which will be the full size of the region
 	}
 	mem_block* getBlock(int index, int pos)
 	{
@@ -308,6 +983,11 @@ public:
 			std::cerr << "ERROR: INVALID BLOCK SPLIT, CANNOT SPLIT AN OCCUPIED BLOCK";
 			return 0;
 		}
+		return split(target);
+	}
+	mem_block* split(mem_block* target) {
+		//splits a leaf into two free children, linked in at the front of the level below
+		int index = fastlog2(target->size);
 		int newSize = target->size >> 1;// = size/2
 
 		mem_block* nodeL = new mem_block(target->index, newSize);
@@ -374,10 +1054,17 @@ public:
 		if (amnt <= 0)
 		{
 			std::cerr << "ERROR: SIZE MUST BE GREATER THAN 0\n";
+			return -1;
 		}
 		int trg_size = getP2(amnt);//first search for first available region in the correct index
 								   //we will assume that necessary merging is done at de-allocation
-		bool search = true;
+		if (trg_size < MIN_ORDER)
+			trg_size = MIN_ORDER;
+		if (trg_size >= m_buddy_list_size)
+		{
+			std::cerr << "ERROR: NOT ENOUGH MEMORY\n";
+			return -1;
+		}
 		int location;
 		if ((location = findAvailableLoc(trg_size)) != -1)//if there is an entry available at this level
 		{
@@ -386,12 +1073,17 @@ public:
 			target_destination->free = false;//mark it as full
 			int targInd = target_destination->index;
 			//m_allocated.push_back(targInd);//add the address we just allocated to our list, for printing purposes
-			*(int*)(m_dataRegion + targInd) = amnt;
+			if (!commitRange(targInd, sizeof(int)))
+			{
+				deallocate(targInd);
+				return -1;
+			}
+			intAt(targInd) = amnt;
 			return targInd;
 		}
 		
 		//Next, we search for the closest memory large enough to accomodate this request
-		int y, x;
+		int y, x = -1;
 		for (y = trg_size + 1; y < m_buddy_list_size && ((x = findAvailableLoc(y)) == -1); y++);//if the current level doesn't have anything, we search up
 		if (x != -1)//assuming we've found an open entry
 		{
@@ -407,7 +1099,12 @@ public:
 				m_buddy_list[trg_size]->free = false;
 				int targInd = m_buddy_list[trg_size]->index;
 				//m_allocated.push_back(targInd);
-				*(int*)(m_dataRegion + targInd) = amnt;//do not know if this will work, but it should set the bytes to be an integer
+				if (!commitRange(targInd, sizeof(int)))
+				{
+					deallocate(targInd);//merges the blocks split for it back together
+					return -1;
+				}
+				intAt(targInd) = amnt;//do not know if this will work, but it should set the bytes to be an integer
 				return targInd;
 			}
 		}
@@ -415,54 +1112,1242 @@ public:
 		{
 			std::cerr << "ERROR: NOT ENOUGH MEMORY\n";
 		}
+		return -1;
 	}
-	void* accessData(int index)
+	void saveTree(std::string& out, mem_block* target, std::map<mem_block*, int>& ids)
 	{
-		return m_dataRegion + index;
+		//preorder, one byte per node: 0 free leaf, 1 taken leaf, 2 split
+		int id = (int)ids.size();
+		ids[target] = id;
+		char code = target->lChild != nullptr ? 2 : (target->free ? 0 : 1);
+		out.push_back(code);
+		if (code == 2)
+		{
+			saveTree(out, target->lChild, ids);
+			saveTree(out, target->rChild, ids);
+		}
 	}
-	~DynamicRegion() {
-		delete[] m_dataRegion;
-		delete m_buddy_list[m_buddy_list_size - 1];//this should delete all nodes in this tree, as this would be the root node
-		delete[] m_buddy_list;
+	mem_block* loadTree(const char*& in, const char* end, mem_block* parent, int index, int size, std::vector<mem_block*>& nodes)
+	{
+		//nullptr if the tree runs past end or splits below the smallest block
+		if (in >= end)
+			return nullptr;
+		char code = *in++;
+		if (code < 0 || code > 2 || (code == 2 && size <= fastPow2(MIN_ORDER)))
+			return nullptr;
+		mem_block* target = new mem_block(index, size);
+		nodes.push_back(target);
+		target->parent = parent;
+		target->free = code == 0;
+		if (code == 2)
+		{
+			target->lChild = loadTree(in, end, target, index, size >> 1, nodes);
+			target->rChild = target->lChild != nullptr ? loadTree(in, end, target, index + (size >> 1), size >> 1, nodes) : nullptr;
+			if (target->rChild == nullptr)
+			{
+				delete target;
+				return nullptr;
+			}
+		}
+		return target;
 	}
-};
-int addressID = 1;
-class AddressSpace;
-struct sharedData
-{
-	std::vector<AddressSpace*> sharedAmongst;
-	data_entry * bss_r;
-	data_entry * data_r;
-	unsigned char * text_r;
-	int text_s;
-	int num_using = 0;
-	void addProg(AddressSpace* c) {
-		sharedAmongst.push_back(c);
-		num_using++;
+	void saveState(std::string& out) {
+		//the tree, then the order of each level's list (by preorder number), since allocation picks the first free block in a list
+		std::map<mem_block*, int> ids;
+		saveTree(out, m_buddy_list[m_buddy_list_size - 1], ids);
+		for (int i = 0; i < m_buddy_list_size; i++)
+		{
+			int count = 0;
+			for (mem_block* t = m_buddy_list[i]; t != nullptr; t = t->next)
+				count++;
+			putRaw(out, count);
+			for (mem_block* t = m_buddy_list[i]; t != nullptr; t = t->next)
+				putRaw(out, ids[t]);
+		}
+		putRaw(out, (int)m_handles.size());
+		out.append((const char*)m_handles.data(), sizeof(int) * m_handles.size());
 	}
-	void notifyLeave()
+	bool loadState(const char*& in, const char* end) {
+		delete m_buddy_list[m_buddy_list_size - 1];
+		for (int i = 0; i < m_buddy_list_size; i++)
+			m_buddy_list[i] = nullptr;
+		std::vector<mem_block*> nodes;
+		mem_block* root = loadTree(in, end, nullptr, 0, m_region_size, nodes);
+		m_buddy_list[m_buddy_list_size - 1] = root != nullptr ? root : new mem_block(0, m_region_size);//the destructor needs a root either way
+		if (root == nullptr)
+			return false;
+		std::vector<bool> listed(nodes.size(), false);
+		for (int i = 0; i < m_buddy_list_size; i++)
+		{
+			int count;
+			if (!readRaw(in, end, count) || count < 0 || count > (int)nodes.size())
+				return false;
+			mem_block* prev = nullptr;
+			for (int j = 0; j < count; j++)
+			{
+				//only blocks of this level, each listed once, otherwise the lists could loop
+				int id;
+				if (!readRaw(in, end, id) || id < 0 || id >= (int)nodes.size() || listed[id] || fastlog2(nodes[id]->size) != i)
+					return false;
+				listed[id] = true;
+				mem_block* t = nodes[id];
+				t->prev = prev;
+				if (prev != nullptr)
+					prev->next = t;
+				else
+					m_buddy_list[i] = t;
+				prev = t;
+			}
+		}
+		int handles;
+		if (!readRaw(in, end, handles) || handles < 0 || handles > (end - in) / (int)sizeof(int))
+			return false;
+		m_handles.resize(handles);
+		if (!m_handles.empty())
+			memcpy(m_handles.data(), in, sizeof(int) * m_handles.size());
+		in += sizeof(int) * m_handles.size();
+		m_free_handles.clear();
+		m_compact_queue.clear();
+		for (int h = 0; h < (int)m_handles.size(); h++)
+		{
+			if (m_handles[h] == -1)
+				m_free_handles.push_back(h);
+			else if (!isAllocated(m_handles[h]))
+				return false;//also catches two handles to one block, since the first one marks it
+			else
+				leafAt(m_handles[h])->handle = true;
+		}
+		return true;
+	}
+	void unlinkSubtree(mem_block* target)
 	{
-		num_using--;
+		unlink(target);
+		if (target->lChild != nullptr) unlinkSubtree(target->lChild);
+		if (target->rChild != nullptr) unlinkSubtree(target->rChild);
 	}
-};
-class AddressSpace {
-private:
-	/*
-	The vectors below are simply here for the print info function: it is not critical to the functioning of the address space
-	*/
-	int text_addresses_end;
-	std::vector<int> bss_addresses;
-	std::vector<int> data_addresses;
-	std::vector<int> stack_addresses;
-	std::vector<int> dynamic_addresses;
-	std::string m_processName;
-	std::string m_shared1;
-	std::string m_shared2;
-	MemStack m_stack;
-	DynamicRegion m_dynamic;//i tried to implement this as a buddy system
-	/*
-	Since data and bss do not have entries added/removed from them during runtime, there will only be a fixed number of addresses in this region.
-	Entires in bss may also be initalized, and as such must be moved into the data region.
+	int reallocate(int index, int amnt) {
+		if (!isAllocated(index) || amnt <= 0)
+		{
+			std::cerr << "ERROR: INVALID REALLOCATION\n";
+			return -1;
+		}
+		return resize(index, amnt);
+	}
+	int resize(int index, int amnt) {
+		//reallocate without the checks, for blocks already known to be live. a handle block keeps its flag wherever it ends up
+		mem_block* target = leafAt(index);
+		bool handle = target->handle;
+		int order = fastlog2(target->size);
+		int trg_size = getP2(amnt);
+		if (trg_size < MIN_ORDER)
+			trg_size = MIN_ORDER;
+		if (trg_size < order)
+		{
+			//shrink: keep splitting the block, holding on to the left half and leaving the right half free
+			while (fastlog2(target->size) > trg_size)
+			{
+				mem_block* left = split(target);
+				left->free = false;
+				left->handle = handle;
+				target->handle = false;
+				releaseRange(target->rChild->index, target->rChild->size);
+				target = left;
+			}
+		}
+		else if (trg_size > order)
+		{
+			//grow: possible in place if the block is the left half at every level up to the new size, and each right buddy on the way is free
+			mem_block* ancestor = target;
+			for (int i = order; i < trg_size; i++)
+			{
+				mem_block* parent = ancestor->parent;
+				if (parent == nullptr || parent->lChild != ancestor || !isFree(parent->rChild))
+				{
+					//otherwise fall back to allocate + copy
+					int moved = allocate(amnt);
+					if (moved == -1)
+						return -1;
+					int old_amnt = intAt(index);
+					if (!copyBytes(moved, index, old_amnt < amnt ? old_amnt : amnt))
+					{
+						release(moved);
+						return -1;
+					}
+					intAt(moved) = amnt;
+					leafAt(moved)->handle = handle;
+					release(index);
+					return moved;
+				}
+				ancestor = parent;
+			}
+			//everything under the ancestor is now either the block itself or a free buddy, so collapse it into a single taken leaf
+			unlinkSubtree(ancestor->lChild);
+			unlinkSubtree(ancestor->rChild);
+			delete ancestor->lChild;
+			delete ancestor->rChild;
+			ancestor->lChild = nullptr;
+			ancestor->rChild = nullptr;
+			ancestor->free = false;
+			ancestor->handle = handle;
+		}
+		intAt(index) = amnt;//the block start doesn't move, only the size header changes
+		return index;
+	}
+	/*
+	Batched version of allocate, giving the same placement as calling allocate for each size in order.
+	The sequential version rescans the level lists on every call. Here the free leaves of each level are collected once, in list order, and kept up to date
+	as blocks are split and taken, so each request is a few queue operations. A parent split for one request leaves its free right halves at the front of
+	the queues, where they serve the following requests of those orders. The size headers are written in one pass at the end.
+	*/
+	std::vector<int> allocateBatch(const int* sizes, int count) {
+		std::vector<std::deque<mem_block*>> free_leaves(m_buddy_list_size);
+		for (int i = 0; i < m_buddy_list_size; i++)
+			for (mem_block* t = m_buddy_list[i]; t != nullptr; t = t->next)
+				if (isFree(t))
+					free_leaves[i].push_back(t);
+		std::vector<int> offsets(count, -1);
+		for (int r = 0; r < count; r++)
+		{
+			if (sizes[r] <= 0)
+			{
+				std::cerr << "ERROR: SIZE MUST BE GREATER THAN 0\n";
+				continue;
+			}
+			int trg_size = getP2(sizes[r]);
+			if (trg_size < MIN_ORDER)
+				trg_size = MIN_ORDER;
+			int y = trg_size;
+			while (y < m_buddy_list_size && free_leaves[y].empty())
+				y++;
+			if (y >= m_buddy_list_size)
+			{
+				std::cerr << "ERROR: NOT ENOUGH MEMORY\n";
+				continue;
+			}
+			for (; y > trg_size; y--)
+			{
+				//split moves the block's children to the head of the level list, so they go to the front of the queue as well
+				mem_block* parent = free_leaves[y].front();
+				free_leaves[y].pop_front();
+				mem_block* left = split(parent);
+				free_leaves[y - 1].push_front(parent->rChild);
+				free_leaves[y - 1].push_front(left);
+			}
+			mem_block* target = free_leaves[trg_size].front();
+			free_leaves[trg_size].pop_front();
+			target->free = false;
+			offsets[r] = target->index;
+		}
+		for (int r = 0; r < count; r++)
+		{
+			if (offsets[r] == -1)
+				continue;
+			if (!commitRange(offsets[r], sizeof(int)))
+			{
+				deallocate(offsets[r]);
+				offsets[r] = -1;
+				continue;
+			}
+			intAt(offsets[r]) = sizes[r];
+		}
+		return offsets;
+	}
+	mem_block* leafAt(int index)
+	{
+		//walks down from the root to the leaf covering index, in log time instead of scanning every level's list like getByAddress
+		mem_block* target = m_buddy_list[m_buddy_list_size - 1];
+		if (index < 0 || index >= m_region_size)
+			return nullptr;
+		while (target->lChild != nullptr)
+			target = index < target->rChild->index ? target->lChild : target->rChild;
+		return target;
+	}
+	bool isAllocated(int index) {
+		//handle blocks don't count, since plain deallocate and reallocate would leave the handle table pointing at the old offset
+		mem_block* target = leafAt(index);
+		return target != nullptr && target->index == index && !target->free && !target->handle;
+	}
+	void deallocate(int index) {
+		if (!isAllocated(index))
+		{
+			mem_block* target = leafAt(index);
+			std::cerr << (target != nullptr && target->index == index && target->handle ? "ERROR: BLOCK BELONGS TO A HANDLE, FREE IT WITH deallocateHandle\n"
+				: "ERROR: INVALID FREE\n");
+			return;
+		}
+		release(index);
+	}
+	void release(int index) {
+		//deallocate without the checks
+		mem_block* target = leafAt(index);
+		target->free = true;
+		target->handle = false;
+		//merge back up the tree for as long as both buddies are free
+		mem_block* parent = target->parent;
+		while (parent != nullptr && isFree(parent->lChild) && isFree(parent->rChild))
+		{
+			target = parent;
+			unlink(parent->lChild);
+			unlink(parent->rChild);
+			delete parent->lChild;
+			delete parent->rChild;
+			parent->lChild = nullptr;
+			parent->rChild = nullptr;
+			parent->free = true;
+			parent = parent->parent;
+		}
+		releaseRange(target->index, target->size);
+	}
+	int allocateHandle(int amnt) {
+		int offset = allocate(amnt);
+		if (offset == -1)
+			return -1;
+		leafAt(offset)->handle = true;
+		int handle;
+		if (!m_free_handles.empty())
+		{
+			handle = m_free_handles.back();
+			m_free_handles.pop_back();
+			m_handles[handle] = offset;
+		}
+		else
+		{
+			handle = (int)m_handles.size();
+			m_handles.push_back(offset);
+		}
+		return handle;
+	}
+	int resolve(int handle) {
+		//handles must be resolved again after every compact() call
+		return handle >= 0 && handle < (int)m_handles.size() ? m_handles[handle] : -1;
+	}
+	void deallocateHandle(int handle) {
+		int offset = resolve(handle);
+		if (offset == -1)
+		{
+			std::cerr << "ERROR: INVALID HANDLE\n";
+			return;
+		}
+		release(offset);
+		m_handles[handle] = -1;
+		m_free_handles.push_back(handle);
+	}
+	int reallocateHandle(int handle, int amnt) {
+		//resizes a handle block and points the handle at wherever it ends up. returns the new offset, or -1 with the block left as it was
+		int offset = resolve(handle);
+		if (offset == -1 || amnt <= 0)
+		{
+			std::cerr << "ERROR: INVALID HANDLE\n";
+			return -1;
+		}
+		int moved = resize(offset, amnt);
+		if (moved != -1)
+			m_handles[handle] = moved;
+		return moved;
+	}
+	int largestFree() {
+		for (int i = m_buddy_list_size - 1; i >= 0; i--)
+			for (mem_block* t = m_buddy_list[i]; t != nullptr; t = t->next)
+				if (isFree(t))
+					return t->size;
+		return 0;
+	}
+	/*
+	Incremental compaction: each step takes the handle block at the highest address and moves it into the lowest free space that fits, if that is lower.
+	The tree is consistent after every step, so the pass can stop when the time budget runs out and carry on in the next call.
+	Returns true once a full pass has finished.
+	*/
+	bool compact(int budget_us) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (m_compact_queue.empty())
+		{
+			for (int h = 0; h < (int)m_handles.size(); h++)
+				if (m_handles[h] != -1)
+					m_compact_queue.push_back(h);
+			std::sort(m_compact_queue.begin(), m_compact_queue.end(), [this](int a, int b) { return m_handles[a] < m_handles[b]; });
+		}
+		while (!m_compact_queue.empty())
+		{
+			if (std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() >= budget_us)
+				return false;
+			int handle = m_compact_queue.back();
+			m_compact_queue.pop_back();
+			int offset = m_handles[handle];
+			if (offset == -1)
+				continue;//freed since the pass started
+			mem_block* block = leafAt(offset);
+			int order = fastlog2(block->size);
+			mem_block* target = lowestFreeLeaf(order);
+			if (target == nullptr || target->index > offset)
+				continue;
+			while (target->size > block->size)
+				target = split(target);
+			target->free = false;
+			if (!copyBytes(target->index, offset, block->size))
+			{
+				//out of frames: put the space back and end the pass, the block stays where it is
+				release(target->index);
+				m_compact_queue.clear();
+				return true;
+			}
+			target->handle = true;
+			m_handles[handle] = target->index;
+			release(offset);//merges the old space back into the free lists
+		}
+		return true;
+	}
+	~DynamicRegion() {
+		delete m_buddy_list[m_buddy_list_size - 1];//this should delete all nodes in this tree, as this would be the root node
+		delete[] m_buddy_list;
+	}
+};
+class TLSFRegion : public HeapAllocator {
+	/*
+	Two level segregated fit: free blocks are kept in lists indexed by (log2 of size, 16 linear subdivisions of that range), and a pair of bitmaps says
+	which lists are non empty, so both allocation and freeing are O(1).
+	Every block starts with an 8 byte header (block size with the free flag in the low bit, then the offset of the previous physical block).
+	Free blocks keep their list links where the user data would go, so the offset handed out is 8 bytes past the block start.
+	*/
+	static const int HEADER = 8;
+	static const int MIN_BLOCK = 16;
+	static const int SL_BITS = 4;
+	static const int SL_COUNT = 1 << SL_BITS;
+	static const int SMALL_SHIFT = 7;//blocks under 128 bytes all go in the first level, in steps of 8
+	int m_fl_count;
+	unsigned int m_fl_bitmap;
+	unsigned int* m_sl_bitmap;
+	int* m_heads;//m_fl_count * SL_COUNT list heads, -1 when empty
+	int& blockSize(int b) { return intAt(b); }
+	int& prevPhys(int b) { return intAt(b + 4); }
+	int& nextFree(int b) { return intAt(b + 8); }
+	int& prevFree(int b) { return intAt(b + 12); }
+	int sizeOf(int b) { return blockSize(b) & ~1; }
+	bool blockFree(int b) { return blockSize(b) & 1; }
+	void mapping(int size, int& fl, int& sl) {
+		if (size < (1 << SMALL_SHIFT))
+		{
+			fl = 0;
+			sl = size >> (SMALL_SHIFT - SL_BITS);
+			return;
+		}
+		int lg = fastlog2(size);
+		fl = lg - SMALL_SHIFT + 1;
+		sl = (size >> (lg - SL_BITS)) - SL_COUNT;
+	}
+	void insertFree(int b) {
+		int fl, sl;
+		mapping(sizeOf(b), fl, sl);
+		int& head = m_heads[fl * SL_COUNT + sl];
+		nextFree(b) = head;
+		prevFree(b) = -1;
+		if (head != -1)
+			prevFree(head) = b;
+		head = b;
+		m_fl_bitmap |= 1u << fl;
+		m_sl_bitmap[fl] |= 1u << sl;
+	}
+	void removeFree(int b) {
+		int fl, sl;
+		mapping(sizeOf(b), fl, sl);
+		if (prevFree(b) != -1)
+			nextFree(prevFree(b)) = nextFree(b);
+		else
+			m_heads[fl * SL_COUNT + sl] = nextFree(b);
+		if (nextFree(b) != -1)
+			prevFree(nextFree(b)) = prevFree(b);
+		if (m_heads[fl * SL_COUNT + sl] == -1)
+		{
+			m_sl_bitmap[fl] &= ~(1u << sl);
+			if (m_sl_bitmap[fl] == 0)
+				m_fl_bitmap &= ~(1u << fl);
+		}
+	}
+	int findFree(int size) {
+		//round the size up to the next list boundary, so any block in the list we land on is big enough
+		if (size >= (1 << SMALL_SHIFT))
+			size += (1 << (fastlog2(size) - SL_BITS)) - 1;
+		int fl, sl;
+		mapping(size, fl, sl);
+		if (fl >= m_fl_count)
+			return -1;
+		unsigned int sl_map = m_sl_bitmap[fl] & (~0u << sl);
+		if (sl_map == 0)
+		{
+			unsigned int fl_map = fl + 1 < 32 ? m_fl_bitmap & (~0u << (fl + 1)) : 0;
+			if (fl_map == 0)
+				return -1;
+			fl = ctz(fl_map);
+			sl_map = m_sl_bitmap[fl];
+		}
+		return m_heads[fl * SL_COUNT + ctz(sl_map)];
+	}
+	int nextPhys(int b) {
+		int n = b + sizeOf(b);
+		return n < m_region_size ? n : -1;
+	}
+	bool isBlock(int b) {
+		//an offset that isn't a block start (a pointer into the middle of one) won't have headers that agree with its neighbours
+		if (b < 0 || b >= m_region_size || (b & 7) != 0)
+			return false;
+		int size = sizeOf(b);
+		if (size < MIN_BLOCK || size > m_region_size - b)
+			return false;
+		int p = prevPhys(b);
+		if (p == -1 ? b != 0 : (p < 0 || p >= b || (p & 7) != 0 || p + sizeOf(p) != b))
+			return false;
+		int n = nextPhys(b);
+		return n == -1 || prevPhys(n) == b;
+	}
+public:
+	const char* getName() { return "TLSF"; }
+	TLSFRegion(int _size = DEFAULT_HEAP_SIZE, FrameAccount* account = nullptr) : HeapAllocator(_size, account) {
+		m_fl_count = fastlog2(m_region_size) - SMALL_SHIFT + 2;
+		m_fl_bitmap = 0;
+		m_sl_bitmap = new unsigned int[m_fl_count];
+		m_heads = new int[m_fl_count * SL_COUNT];
+		for (int i = 0; i < m_fl_count; i++)
+			m_sl_bitmap[i] = 0;
+		for (int i = 0; i < m_fl_count * SL_COUNT; i++)
+			m_heads[i] = -1;
+		if (!commitRange(0, MIN_BLOCK))
+			return;//no free block at all, so every allocation fails
+		blockSize(0) = m_region_size | 1;//one free block spanning the whole region
+		prevPhys(0) = -1;
+		insertFree(0);
+	}
+	int allocate(int amnt) {
+		if (amnt <= 0)
+		{
+			std::cerr << "ERROR: SIZE MUST BE GREATER THAN 0\n";
+			return -1;
+		}
+		int need = (amnt + HEADER + 7) & ~7;
+		if (need < MIN_BLOCK)
+			need = MIN_BLOCK;
+		int b = findFree(need);
+		if (b == -1)
+		{
+			std::cerr << "ERROR: NOT ENOUGH MEMORY\n";
+			return -1;
+		}
+		int remainder = sizeOf(b) - need;
+		if (remainder >= MIN_BLOCK && !commitRange(b + need, MIN_BLOCK))
+			return -1;//the free block's own header and links are already paged in, only the split-off tail's may not be
+		removeFree(b);
+		if (remainder >= MIN_BLOCK)
+		{
+			//split the tail off into its own free block
+			int r = b + need;
+			blockSize(r) = remainder | 1;
+			prevPhys(r) = b;
+			int n = nextPhys(r);
+			if (n != -1)
+				prevPhys(n) = r;
+			insertFree(r);
+			blockSize(b) = need;
+		}
+		else
+		{
+			blockSize(b) = sizeOf(b);
+		}
+		intAt(b + HEADER) = amnt;
+		return b + HEADER;
+	}
+	bool isAllocated(int index) {
+		return isBlock(index - HEADER) && !blockFree(index - HEADER);
+	}
+	void deallocate(int index) {
+		int b = index - HEADER;
+		if (!isAllocated(index))
+		{
+			std::cerr << "ERROR: INVALID FREE\n";
+			return;
+		}
+		int n = nextPhys(b);
+		if (n != -1 && blockFree(n))
+		{
+			//absorb the next block
+			removeFree(n);
+			blockSize(b) = sizeOf(b) + sizeOf(n);
+		}
+		int p = prevPhys(b);
+		if (p != -1 && blockFree(p))
+		{
+			//and fold into the previous one
+			removeFree(p);
+			blockSize(p) = sizeOf(p) + sizeOf(b);
+			b = p;
+		}
+		blockSize(b) = sizeOf(b) | 1;
+		n = nextPhys(b);
+		if (n != -1)
+			prevPhys(n) = b;
+		insertFree(b);
+		releaseRange(b + 16, sizeOf(b) - 16);//past the header and free links nothing in a free block is read
+	}
+	void print_nodes()
+	{
+		for (int b = 0; b != -1 && sizeOf(b) != 0; b = nextPhys(b))//a zero size only shows up if the first header could never be paged in
+			std::cout << "[" << b << ", Size: " << sizeOf(b) << (blockFree(b) ? ", FREE" : ", TAKEN") << "] ";
+		std::cout << std::endl;
+	}
+	void saveState(std::string& out) {
+		//block headers live in the data region, so only the list heads and bitmaps are needed
+		putRaw(out, m_fl_bitmap);
+		out.append((const char*)m_sl_bitmap, sizeof(unsigned int) * m_fl_count);
+		out.append((const char*)m_heads, sizeof(int) * m_fl_count * SL_COUNT);
+	}
+	bool loadState(const char*& in, const char* end) {
+		if ((size_t)(end - in) < sizeof(unsigned int) * (1 + m_fl_count) + sizeof(int) * m_fl_count * SL_COUNT)
+			return false;
+		m_fl_bitmap = getRaw<unsigned int>(in);
+		memcpy(m_sl_bitmap, in, sizeof(unsigned int) * m_fl_count);
+		in += sizeof(unsigned int) * m_fl_count;
+		memcpy(m_heads, in, sizeof(int) * m_fl_count * SL_COUNT);
+		in += sizeof(int) * m_fl_count * SL_COUNT;
+		//the bitmaps have to agree with the list heads, findFree trusts them
+		if (m_fl_count < 32 && (m_fl_bitmap >> m_fl_count) != 0)
+			return false;
+		for (int fl = 0; fl < m_fl_count; fl++)
+		{
+			if (((m_fl_bitmap >> fl) & 1) != (m_sl_bitmap[fl] != 0 ? 1u : 0u))
+				return false;
+			for (int sl = 0; sl < SL_COUNT; sl++)
+			{
+				int head = m_heads[fl * SL_COUNT + sl];
+				if (((m_sl_bitmap[fl] >> sl) & 1) != (head != -1 ? 1u : 0u) || (head != -1 && (head < 0 || head >= m_region_size || (head & 7) != 0)))
+					return false;
+			}
+		}
+		return true;
+	}
+	~TLSFRegion() {
+		delete[] m_sl_bitmap;
+		delete[] m_heads;
+	}
+};
+class SegregatedRegion : public HeapAllocator {
+	/*
+	Segregated fit with power of 2 size classes. Each class has its own singly linked free list (the link is stored in the freed block), new blocks are
+	carved off the end of the used part of the region, and when that runs out a block from a larger class is split down.
+	*/
+	static const int MIN_ORDER = 4;
+	int m_class_count;
+	int* m_free_lists;
+	int m_frontier;
+	BlockBits m_live;//by 16 byte unit, set while a block starting there is handed out
+	int classOf(int amnt) {
+		int order = getP2(amnt);
+		return order < MIN_ORDER ? 0 : order - MIN_ORDER;
+	}
+	int& link(int b) { return intAt(b); }
+	void push(int c, int b) {
+		link(b) = m_free_lists[c];
+		m_free_lists[c] = b;
+	}
+public:
+	const char* getName() { return "SEGREGATED"; }
+	SegregatedRegion(int _size = DEFAULT_HEAP_SIZE, FrameAccount* account = nullptr) : HeapAllocator(_size, account) {
+		m_class_count = fastlog2(m_region_size) - MIN_ORDER + 1;
+		m_free_lists = new int[m_class_count];
+		for (int i = 0; i < m_class_count; i++)
+			m_free_lists[i] = -1;
+		m_frontier = 0;
+		m_live.reset(m_region_size >> MIN_ORDER);
+	}
+	int allocate(int amnt) {
+		if (amnt <= 0)
+		{
+			std::cerr << "ERROR: SIZE MUST BE GREATER THAN 0\n";
+			return -1;
+		}
+		int c = classOf(amnt);
+		int size = fastPow2(c + MIN_ORDER);
+		int b = -1;
+		if (c < m_class_count && m_free_lists[c] != -1)
+		{
+			b = m_free_lists[c];
+			m_free_lists[c] = link(b);
+		}
+		else if (m_frontier + size <= m_region_size)
+		{
+			if (!commitRange(m_frontier, sizeof(int)))
+				return -1;
+			b = m_frontier;
+			m_frontier += size;
+		}
+		else
+		{
+			//split the smallest larger free block down, leaving the upper halves on the lists in between
+			int y;
+			for (y = c + 1; y < m_class_count && m_free_lists[y] == -1; y++);
+			if (y < m_class_count)
+			{
+				b = m_free_lists[y];
+				for (int i = y - 1; i >= c; i--)
+					if (!commitRange(b + fastPow2(i + MIN_ORDER), sizeof(int)))
+						return -1;//the upper halves get links written into them
+				m_free_lists[y] = link(b);
+				for (int i = y - 1; i >= c; i--)
+					push(i, b + fastPow2(i + MIN_ORDER));
+			}
+		}
+		if (b == -1)
+		{
+			std::cerr << "ERROR: NOT ENOUGH MEMORY\n";
+			return -1;
+		}
+		intAt(b) = amnt;
+		m_live.set(b >> MIN_ORDER, true);
+		return b;
+	}
+	bool isAllocated(int index) {
+		//blocks on a free list hold a link where the header was, so a double free can only be caught with the live bits
+		return index >= 0 && index < m_frontier && (index & ((1 << MIN_ORDER) - 1)) == 0 && m_live.get(index >> MIN_ORDER)
+			&& intAt(index) > 0 && classOf(intAt(index)) < m_class_count;
+	}
+	void deallocate(int index) {
+		if (!isAllocated(index))
+		{
+			std::cerr << "ERROR: INVALID FREE\n";
+			return;
+		}
+		m_live.set(index >> MIN_ORDER, false);
+		push(classOf(intAt(index)), index);//the class comes from the size header, which the link then overwrites
+	}
+	void print_nodes()
+	{
+		for (int i = 0; i < m_class_count; i++)
+		{
+			std::cout << "[" << fastPow2(i + MIN_ORDER) << "] - ";
+			int count = 0;
+			for (int b = m_free_lists[i]; b != -1; b = link(b))
+				count++;
+			std::cout << count << " FREE" << std::endl;
+		}
+		std::cout << "[FRONTIER] - " << m_frontier << std::endl;
+	}
+	void saveState(std::string& out) {
+		putRaw(out, m_frontier);
+		out.append((const char*)m_free_lists, sizeof(int) * m_class_count);
+		m_live.save(out);
+	}
+	bool loadState(const char*& in, const char* end) {
+		if (!readRaw(in, end, m_frontier) || m_frontier < 0 || m_frontier > m_region_size || (size_t)(end - in) < sizeof(int) * m_class_count)
+			return false;
+		memcpy(m_free_lists, in, sizeof(int) * m_class_count);
+		in += sizeof(int) * m_class_count;
+		for (int i = 0; i < m_class_count; i++)
+			if (m_free_lists[i] != -1 && (m_free_lists[i] < 0 || m_free_lists[i] >= m_frontier || (m_free_lists[i] & ((1 << MIN_ORDER) - 1)) != 0))
+				return false;
+		return m_live.load(in, end);
+	}
+	~SegregatedRegion() {
+		delete[] m_free_lists;
+	}
+};
+class BumpRegion : public HeapAllocator {
+	/*
+	Bump allocator: blocks are handed out in order and never reused individually. Once every block has been freed the whole region is reset.
+	*/
+	int m_frontier;
+	int m_live;
+	BlockBits m_starts;//by 8 byte unit, set while a block starting there is live
+public:
+	const char* getName() { return "BUMP"; }
+	BumpRegion(int _size = DEFAULT_HEAP_SIZE, FrameAccount* account = nullptr) : HeapAllocator(_size, account) {
+		m_frontier = 0;
+		m_live = 0;
+		m_starts.reset(m_region_size >> 3);
+	}
+	int allocate(int amnt) {
+		if (amnt <= 0)
+		{
+			std::cerr << "ERROR: SIZE MUST BE GREATER THAN 0\n";
+			return -1;
+		}
+		int size = ((amnt < 4 ? 4 : amnt) + 7) & ~7;
+		if (m_frontier + size > m_region_size)
+		{
+			std::cerr << "ERROR: NOT ENOUGH MEMORY\n";
+			return -1;
+		}
+		if (!commitRange(m_frontier, sizeof(int)))
+			return -1;
+		int b = m_frontier;
+		m_frontier += size;
+		m_live++;
+		intAt(b) = amnt;
+		m_starts.set(b >> 3, true);
+		return b;
+	}
+	bool isAllocated(int index) {
+		return index >= 0 && index < m_frontier && (index & 7) == 0 && m_starts.get(index >> 3);
+	}
+	void deallocate(int index) {
+		if (!isAllocated(index))
+		{
+			std::cerr << "ERROR: INVALID FREE\n";
+			return;
+		}
+		m_starts.set(index >> 3, false);
+		if (--m_live == 0)
+		{
+			releaseRange(0, m_frontier);
+			m_starts.clearBelow(m_frontier >> 3);
+			m_frontier = 0;
+		}
+	}
+	void print_nodes()
+	{
+		std::cout << "[FRONTIER] - " << m_frontier << ", " << m_live << " LIVE BLOCKS" << std::endl;
+	}
+	void saveState(std::string& out) {
+		putRaw(out, m_frontier);
+		putRaw(out, m_live);
+		m_starts.save(out);
+	}
+	bool loadState(const char*& in, const char* end) {
+		if (!readRaw(in, end, m_frontier) || m_frontier < 0 || m_frontier > m_region_size || (m_frontier & 7) != 0 || !readRaw(in, end, m_live)
+			|| !m_starts.load(in, end))
+			return false;
+		int starts = 0;
+		for (int unit = 0; unit < (m_frontier >> 3); unit++)
+			starts += m_starts.get(unit) ? 1 : 0;
+		return starts == m_live;//deallocate resets the region when the count reaches 0, so it has to match the blocks actually handed out
+	}
+};
+enum AllocatorKind {
+	A_BUDDY,
+	A_TLSF,
+	A_SEGREGATED,
+	A_BUMP,
+	A_COUNT
+};
+HeapAllocator* makeHeapAllocator(AllocatorKind kind, int size, FrameAccount* account = nullptr)
+{
+	switch (kind)
+	{
+	case A_TLSF:
+		return new TLSFRegion(size, account);
+	case A_SEGREGATED:
+		return new SegregatedRegion(size, account);
+	case A_BUMP:
+		return new BumpRegion(size, account);
+	default:
+		return new DynamicRegion(size, account);
+	}
+}
+/*
+Dirty tracking for one region: a bit per unit (an entry, or a page of 2^shift bytes), plus the list of units that went dirty since the last clear,
+so producing a diff only touches what actually changed.
+*/
+class DirtyMap {
+	std::vector<unsigned long long> m_bits;
+	std::vector<int> m_dirty;
+	int m_units;
+	int m_shift;
+public:
+	DirtyMap(int length = 0, int shift = 0) { reset(length, shift); }
+	void reset(int length, int shift) {
+		m_shift = shift;
+		m_units = (length + (1 << shift) - 1) >> shift;
+		m_bits.assign((m_units + 63) / 64, 0);
+		m_dirty.clear();
+	}
+	void mark(int index) {
+		int unit = index >> m_shift;
+		if (unit < 0 || unit >= m_units)
+			return;
+		unsigned long long bit = 1ull << (unit & 63);
+		if (!(m_bits[unit >> 6] & bit))
+		{
+			m_bits[unit >> 6] |= bit;
+			m_dirty.push_back(unit);
+		}
+	}
+	void markRange(int index, int length) {
+		for (int unit = index >> m_shift; length > 0 && unit <= (index + length - 1) >> m_shift; unit++)
+			mark(unit << m_shift);
+	}
+	int unitSize() { return 1 << m_shift; }
+	int count() { return (int)m_dirty.size(); }
+	std::vector<int> take() {
+		//returns the dirty units in order, and starts a new epoch
+		std::vector<int> dirty;
+		dirty.swap(m_dirty);
+		std::sort(dirty.begin(), dirty.end());
+		for (int unit : dirty)
+			m_bits[unit >> 6] &= ~(1ull << (unit & 63));
+		return dirty;
+	}
+};
+#define DIRTY_PAGE_SHIFT 8//the heap is tracked in 256 byte pages, every other region per entry
+/*
+Page sizes used by the translation path. Everything is mapped with 4 KB base pages (the frame size), except that a 2 MB aligned stretch covered entirely by
+one mapping (the text segment, or a single large heap block) is promoted to a superpage, and demoted again as soon as that mapping is freed or moves.
+*/
+#define SUPERPAGE_SHIFT 21//2 MB superpages
+#define SUPERPAGE_SIZE (1ull << SUPERPAGE_SHIFT)
+class SuperpageMap {
+	vaddr_t m_first;//superpage number of the region's start
+	std::vector<char> m_huge;
+	int m_count;
+	int m_promotions;
+	int m_demotions;
+public:
+	SuperpageMap() { reset(0, 0); }
+	void reset(vaddr_t start, vaddr_t length) {
+		m_first = start >> SUPERPAGE_SHIFT;
+		m_huge.assign((size_t)(((start + length + SUPERPAGE_SIZE - 1) >> SUPERPAGE_SHIFT) - m_first), 0);
+		m_count = 0;
+		m_promotions = 0;
+		m_demotions = 0;
+	}
+	inline bool isHuge(vaddr_t address) {
+		vaddr_t slot = (address >> SUPERPAGE_SHIFT) - m_first;//wraps around for addresses below the region, so the bounds check covers both ends
+		return slot < m_huge.size() && m_huge[(size_t)slot];
+	}
+	int promote(vaddr_t begin, vaddr_t end) {
+		//every superpage lying entirely inside [begin, end), returns how many changed
+		int changed = 0;
+		for (vaddr_t page = (begin + SUPERPAGE_SIZE - 1) >> SUPERPAGE_SHIFT; (page + 1) << SUPERPAGE_SHIFT <= end; page++)
+		{
+			char& huge = m_huge[(size_t)(page - m_first)];
+			changed += !huge;
+			huge = 1;
+		}
+		m_count += changed;
+		m_promotions += changed;
+		return changed;
+	}
+	int demote(vaddr_t begin, vaddr_t end) {
+		int changed = 0;
+		for (vaddr_t page = (begin + SUPERPAGE_SIZE - 1) >> SUPERPAGE_SHIFT; (page + 1) << SUPERPAGE_SHIFT <= end; page++)
+		{
+			char& huge = m_huge[(size_t)(page - m_first)];
+			changed += huge;
+			huge = 0;
+		}
+		m_count -= changed;
+		m_demotions += changed;
+		return changed;
+	}
+	int count() { return m_count; }
+	int getPromotions() { return m_promotions; }
+	int getDemotions() { return m_demotions; }
+};
+/*
+Simulated TLB, attached with AddressSpace::enableTlb. Like most hardware it has separate arrays for base pages and superpages, each set associative and
+kept in LRU order within a set. It doesn't change what accessAddress returns, it only counts what a real TLB would have done with the same addresses.
+*/
+#define TLB_WAYS 4
+class TlbModel {
+	struct Array {
+		int shift;
+		int sets;
+		std::vector<vaddr_t> tags;//page number + 1 for each way (0 when empty), most recently used first within a set
+		void init(int entries, int _shift) {
+			shift = _shift;
+			sets = entries / TLB_WAYS > 0 ? entries / TLB_WAYS : 1;
+			tags.assign((size_t)sets * TLB_WAYS, 0);
+		}
+		bool lookup(vaddr_t address) {
+			vaddr_t tag = (address >> shift) + 1;
+			vaddr_t* set = &tags[(size_t)(tag % sets) * TLB_WAYS];
+			int way = 0;
+			while (way < TLB_WAYS - 1 && set[way] != tag)
+				way++;
+			bool hit = set[way] == tag;
+			for (; way > 0; way--)//on a miss this pushes out the least recently used way
+				set[way] = set[way - 1];
+			set[0] = tag;
+			return hit;
+		}
+		int invalidate(vaddr_t begin, vaddr_t end) {
+			int dropped = 0;
+			for (vaddr_t& tag : tags)
+			{
+				if (tag != 0 && ((tag - 1) << shift) < end && (tag << shift) > begin)
+				{
+					tag = 0;
+					dropped++;
+				}
+			}
+			return dropped;
+		}
+		int valid() {
+			int count = 0;
+			for (vaddr_t tag : tags)
+				count += tag != 0;
+			return count;
+		}
+	};
+	Array m_base;
+	Array m_super;
+	unsigned long long m_accesses;
+	unsigned long long m_super_accesses;
+	unsigned long long m_base_misses;
+	unsigned long long m_super_misses;
+	int m_shootdowns;
+public:
+	TlbModel(int base_entries = 64, int super_entries = 32) {
+		m_base.init(base_entries, FRAME_SHIFT);
+		m_super.init(super_entries, SUPERPAGE_SHIFT);
+		resetCounts();
+	}
+	inline void translate(vaddr_t address, bool super) {
+		m_accesses++;
+		if (super)
+		{
+			m_super_accesses++;
+			m_super_misses += !m_super.lookup(address);
+		}
+		else
+		{
+			m_base_misses += !m_base.lookup(address);
+		}
+	}
+	void invalidate(vaddr_t begin, vaddr_t end) {
+		//a mapping changed page size, so any entry covering it is stale
+		m_shootdowns += m_base.invalidate(begin, end) + m_super.invalidate(begin, end);
+	}
+	void resetCounts() {
+		m_accesses = 0;
+		m_super_accesses = 0;
+		m_base_misses = 0;
+		m_super_misses = 0;
+		m_shootdowns = 0;
+	}
+	unsigned long long getAccesses() { return m_accesses; }
+	unsigned long long getMisses() { return m_base_misses + m_super_misses; }
+	double getMissRate() { return m_accesses == 0 ? 0 : (double)getMisses() / m_accesses; }
+	vaddr_t getReach() { return ((vaddr_t)m_base.valid() << FRAME_SHIFT) + ((vaddr_t)m_super.valid() << SUPERPAGE_SHIFT); }//what the current entries cover
+	vaddr_t getMaxReach() { return ((vaddr_t)m_base.tags.size() << FRAME_SHIFT) + ((vaddr_t)m_super.tags.size() << SUPERPAGE_SHIFT); }
+	void print() {
+		std::cout << "ENTRIES: " << m_base.tags.size() << " x 4 KB, " << m_super.tags.size() << " x 2 MB (" << TLB_WAYS << " WAY)\n";
+		std::cout << "REACH: " << (getReach() >> 10) << " KB OF " << (getMaxReach() >> 10) << " KB\n";
+		std::cout << "ACCESSES: " << m_accesses << " (" << m_super_accesses << " THROUGH SUPERPAGES)\n";
+		std::cout << "MISSES: " << getMisses() << " (" << m_base_misses << " BASE, " << m_super_misses << " SUPER), MISS RATE " << getMissRate() * 100 << "%\n";
+		std::cout << "SHOOTDOWNS: " << m_shootdowns << "\n";
+	}
+};
+
+#ifdef PROFILE_ACCESSES
+/*
+Access profiler, only compiled in with -DPROFILE_ACCESSES (otherwise neither this class nor the hooks in accessIn exist).
+Every Nth access is sampled: its region and page counts go up by N (so the counts are estimates, exact when N is 1) and its address is written into a
+ring buffer that keeps the most recent samples. The common path is only a countdown, and AddressSpace only switches to the profiled accessIn while a
+profiler is attached, so a space that isn't being profiled runs the same code as a build without the define. When the countdown runs out the access is
+handed to a separate cold function that does it unprofiled and then records it, so the profiled accessIn stays as lean as the plain one.
+A profiler belongs to one AddressSpace and, like the space, isn't safe to share between threads (none of its counts are atomic).
+*/
+#ifdef _MSC_VER
+#define PROFILE_COLD __declspec(noinline)
+#define PROFILE_UNLIKELY(x) (x)
+#else
+#define PROFILE_COLD __attribute__((noinline, cold))//keeps the sampling slow path out of accessIn, so it doesn't need to save extra registers
+#define PROFILE_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#endif
+const char* regionName(int region)
+{
+	const char* names[] = { "NULL", "TEXT", "BSS", "DATA", "DYNAMIC", "STACK" };
+	return region >= 0 && region < R_COUNT ? names[region] : "NULL";
+}
+class AccessProfiler {
+	RuntimeLayout m_layout;
+	int m_page_shift;
+	int m_sample_every;
+	unsigned int m_jitter;//xorshift state, varies the gap between samples so they don't alias with loops whose period divides the sample rate
+	unsigned long long m_region_counts[R_COUNT];
+	std::vector<unsigned int> m_page_counts[R_COUNT];
+	std::vector<vaddr_t> m_samples;//size is a power of 2
+	unsigned long long m_sample_head;
+	vaddr_t pageAddress(int region, int page) {
+		vaddr_t local = (vaddr_t)page << m_page_shift;
+		switch (region)
+		{
+		case R_TEXT: return m_layout.TEXT_START + local;
+		case R_BSS: return m_layout.BSS_START + local;
+		case R_DATA: return m_layout.DATA_START + local;
+		case R_DYNAMIC: return m_layout.DYNAMIC_START + local;
+		case R_STACK: return m_layout.stackAddress((int)local);
+		default: return 0;
+		}
+	}
+public:
+	AccessProfiler(const RuntimeLayout& layout, const int region_sizes[R_COUNT], int sample_every, int page_shift, int ring_size = 4096) {
+		m_layout = layout;
+		m_page_shift = page_shift;
+		m_sample_every = sample_every < 1 ? 1 : sample_every;
+		m_jitter = 2463534242u;
+		m_sample_head = 0;
+		for (int r = 0; r < R_COUNT; r++)
+		{
+			m_region_counts[r] = 0;
+			m_page_counts[r].assign((region_sizes[r] >> page_shift) + 1, 0);
+		}
+		int size = 1;
+		while (size < ring_size) size <<= 1;
+		m_samples.assign(size, 0);
+	}
+	int getSampleEvery() { return m_sample_every; }
+	int sample(int region, vaddr_t local, vaddr_t address) {
+		//local is the index within the region. Returns how many accesses to skip before the next sample
+		m_region_counts[region] += m_sample_every;
+		m_page_counts[region][local >> m_page_shift] += m_sample_every;
+		m_samples[m_sample_head++ & (m_samples.size() - 1)] = address;
+		m_jitter ^= m_jitter << 13;
+		m_jitter ^= m_jitter >> 17;
+		m_jitter ^= m_jitter << 5;
+		return 1 + (int)(((unsigned long long)m_jitter * (unsigned int)(2 * m_sample_every - 1)) >> 32);//averages m_sample_every, multiply-shift instead of a divide
+	}
+	unsigned long long getRegionCount(int region) { return m_region_counts[region]; }
+	std::vector<vaddr_t> getSamples() {
+		//the most recent samples, oldest first
+		unsigned long long head = m_sample_head;
+		unsigned long long count = head < m_samples.size() ? head : m_samples.size();
+		std::vector<vaddr_t> out;
+		for (unsigned long long i = head - count; i < head; i++)
+			out.push_back(m_samples[i & (m_samples.size() - 1)]);
+		return out;
+	}
+	void printHeatmap(int width = 64) {
+		//one row per region, each column summing a run of pages, shaded relative to the hottest column of that row
+		const char shades[] = " .:-=+*#%@";
+		for (int r = R_TEXT; r < R_COUNT; r++)
+		{
+			std::vector<unsigned int>& pages = m_page_counts[r];
+			int columns = (int)pages.size() < width ? (int)pages.size() : width;
+			std::vector<unsigned long long> sums(columns, 0);
+			unsigned long long hottest = 0;
+			for (size_t p = 0; p < pages.size(); p++)
+				sums[p * columns / pages.size()] += pages[p];
+			for (unsigned long long c : sums)
+				hottest = c > hottest ? c : hottest;
+			std::cout << "[" << regionName(r) << "] - " << m_region_counts[r] << " ACCESSES |";
+			for (unsigned long long c : sums)
+				std::cout << shades[hottest == 0 ? 0 : (c * 9 + hottest - 1) / hottest];
+			std::cout << "|\n";
+		}
+	}
+	void printHotPages(int n) {
+		std::vector<std::pair<unsigned int, std::pair<int, int>>> hot;//count, (region, page)
+		for (int r = R_TEXT; r < R_COUNT; r++)
+			for (size_t p = 0; p < m_page_counts[r].size(); p++)
+				if (m_page_counts[r][p] != 0)
+					hot.push_back(std::make_pair(m_page_counts[r][p], std::make_pair(r, (int)p)));
+		n = n < (int)hot.size() ? n : (int)hot.size();
+		std::partial_sort(hot.begin(), hot.begin() + n, hot.end(), [](const std::pair<unsigned int, std::pair<int, int>>& a, const std::pair<unsigned int, std::pair<int, int>>& b) { return a.first > b.first; });
+		for (int i = 0; i < n; i++)
+			std::cout << std::hex << "[0x" << pageAddress(hot[i].second.first, hot[i].second.second) << "] - [" << std::dec << hot[i].first << " ACCESSES, "
+				<< regionName(hot[i].second.first) << "]\n";
+	}
+};
+#define PROFILE_ACCESS(layout, index) if (PROFILE && PROFILE_UNLIKELY(--m_sample_countdown == 0)) return accessSampled<WRITE, TLB>(layout, index)
+#else
+#define PROFILE_ACCESS(layout, index)
+#endif
+int addressID = 1;
+class AddressSpace;
+struct sharedData
+{
+	std::vector<AddressSpace*> sharedAmongst;
+	data_entry * bss_r;
+	data_entry * data_r;
+	unsigned char * text_r;
+	int text_s;
+	int num_using = 0;
+	std::string key;//the programLinks entry this struct is stored under, so checkpoints can refer back to it
+	bool restored = false;//built by restoreCheckpoint, so its entry arrays are freed (and its programLinks entry dropped) along with the last process using it
+	void addProg(AddressSpace* c) {
+		sharedAmongst.push_back(c);
+		num_using++;
+	}
+	void notifyLeave()
+	{
+		num_using--;
+	}
+};
+std::map<std::string, sharedData> programLinks;
+/*
+Checkpoints are mapped privately, so the heap bytes are only read in as they're touched, and writes to them never reach the file.
+*/
+#define CHECKPOINT_MAGIC "ASCK"
+#define CHECKPOINT_VERSION 4//2: buddy metadata includes the handle table, 3: large heap blocks are listed for superpage promotion, 4: segregated and bump engines save their live blocks
+#define CHECKPOINT_ALIGN 4096//the heap bytes start on a page boundary in the file
+char* mapCheckpoint(const std::string& path, size_t& size)
+{
+#ifdef NO_MMAP
+	std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+	if (!ifs)
+		return nullptr;
+	size = (size_t)ifs.tellg();
+	char* base = new char[size];
+	ifs.seekg(0);
+	ifs.read(base, size);
+	return base;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return nullptr;
+	struct stat st;
+	fstat(fd, &st);
+	size = (size_t)st.st_size;
+	void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);//the mapping stays valid after the descriptor is closed
+	return base == MAP_FAILED ? nullptr : (char*)base;
+#endif
+}
+void unmapCheckpoint(char* base, size_t size)
+{
+#ifdef NO_MMAP
+	delete[] base;
+#else
+	munmap(base, size);
+#endif
+}
+class AddressSpace {
+private:
+	/*
+	The vectors below are simply here for the print info function: it is not critical to the functioning of the address space
+	*/
+	vaddr_t text_addresses_end;
+	std::vector<vaddr_t> bss_addresses;
+	std::vector<vaddr_t> data_addresses;
+	std::vector<vaddr_t> stack_addresses;
+	std::vector<vaddr_t> dynamic_addresses;
+	std::string m_processName;
+	RuntimeLayout m_layout;//must be declared before the stack and heap, since their sizes come from it
+	void* (AddressSpace::*m_access)(vaddr_t);//accessAddress instantiated for the layout this space was built with
+	void* (AddressSpace::*m_access_write)(vaddr_t);//the same, but marking what it touches as dirty
+	void* (AddressSpace::*m_access_variants[8])(vaddr_t);//every instantiation for the layout, by WRITE | PROFILE << 1 | TLB << 2, so hooks cost nothing while detached
+	/*
+	Dirty state since the last dump (full or diff). Heap allocation changes are kept as events, since they can't be recovered from the bytes alone.
+	*/
+	DirtyMap m_text_dirty;
+	DirtyMap m_data_dirty;
+	DirtyMap m_dynamic_dirty;
+	DirtyMap m_stack_dirty;
+	std::map<vaddr_t, bool> m_heap_events;//addresses allocated, resized (false) or freed (true) this epoch, the latest event wins
+	int m_epoch = 0;
+#ifdef PROFILE_ACCESSES
+	AccessProfiler* m_profiler = nullptr;
+	int m_sample_countdown = 0;//kept here rather than in the profiler, so the common path doesn't have to load the profiler pointer
+#endif
+	SuperpageMap m_text_pages;//page sizes for the text segment and the heap, every other region only uses base pages
+	SuperpageMap m_heap_pages;
+	std::map<vaddr_t, int> m_large_blocks;//heap blocks big enough to cover a superpage, by address
+	bool m_superpages = true;
+	TlbModel* m_tlb = nullptr;
+	std::string m_shared1;
+	std::string m_shared2;
+	FrameAccount m_frame_account;//frames this process holds in the global pool, the stack and heap are paged in from it on first touch
+	MemStack m_stack;
+	HeapAllocator* m_dynamic;//i tried to implement this as a buddy system (the default engine), but any HeapAllocator can be used
+	/*
+	Since data and bss do not have entries added/removed from them during runtime, there will only be a fixed number of addresses in this region.
+	Entires in bss may also be initalized, and as such must be moved into the data region.
 	To avoid complexity, we will store all of these address in one singular array, and move entries as needed to mark where the BSS ends and data begins.
 	*/
 	int m_bss_end;//indexes used for tracking what the layout of the data region looks like
@@ -472,6 +2357,20 @@ private:
 	int m_text_end;
 	unsigned char* m_text;//this will be an array of bytes, we will be using the char primative as it only consumes one byte of memory in most systems
 	sharedData * m_shareStruct;
+	AllocatorKind m_heap_kind;
+	char* m_checkpoint = nullptr;//mapped checkpoint backing the heap, if this space was restored from one
+	size_t m_checkpoint_size = 0;
+	static AddressSpace* buildForRestore(const RuntimeLayout& layout, data_entry* stack, sharedData* share, AllocatorKind kind)
+	{
+		//pick the static layout the checkpoint was written with, so the restored space gets the same specialized accessAddress
+		if (layout.sameAs(RuntimeLayout::of<ClassicLayout>()))
+			return new AddressSpace(stack, nullptr, 0, share->bss_r, share->data_r, share->text_r, share->text_s, ClassicLayout(), kind);
+		if (layout.sameAs(RuntimeLayout::of<Layout32>()))
+			return new AddressSpace(stack, nullptr, 0, share->bss_r, share->data_r, share->text_r, share->text_s, Layout32(), kind);
+		if (layout.sameAs(RuntimeLayout::of<Layout64>()))
+			return new AddressSpace(stack, nullptr, 0, share->bss_r, share->data_r, share->text_r, share->text_s, Layout64(), kind);
+		return new AddressSpace(stack, nullptr, 0, share->bss_r, share->data_r, share->text_r, share->text_s, layout, kind);
+	}
 public:
 	/*
 	Since i'm using C++, it is expected that the user will pass type information along with the data (or at the very least, the size of these entries).
@@ -500,44 +2399,322 @@ public:
 		// <data shared proc1><data shared proc2><text shared proc1><text shared proc2>  <blank><blank><data shared><text shared>
 		m_shareStruct = sharestruct;
 	}
-	AddressSpace(data_entry* stack, int* dynamic, int dynamic_size, data_entry* bss, data_entry* data, unsigned char* text, int text_size) {
-
-		m_processName = "PROCESS"+std::to_string(addressID++);
+	template<class L = ClassicLayout>
+	AddressSpace(data_entry* stack, int* dynamic, int dynamic_size, data_entry* bss, data_entry* data, unsigned char* text, int text_size, const L& layout = L(),
+		AllocatorKind heap = A_BUDDY, int frame_quota = -1)
+		: m_layout(bindLayout(layout)), m_frame_account(frame_quota), m_stack(m_layout.STACK_SIZE, &m_frame_account),
+		m_dynamic(makeHeapAllocator(heap, m_layout.HEAP_SIZE, &m_frame_account)) {
+
+		m_processName = "PROCESS"+std::to_string(addressID++);
+		m_heap_kind = heap;
+
+		int i = 0;
+		if (stack != nullptr) {
+			while (stack[i].dataType != T_VOID)
+			{
+				if (m_stack.push(stack[i]))
+					stack_addresses.push_back(m_layout.stackAddress(i));
+				i++;
+			}
+		}
+		
+		m_stack_dirty.reset(m_layout.STACK_SIZE, 0);
+		m_stack_dirty.markRange(0, m_stack.getCount());
+
+		//next, populate the BSS and data region
+		m_bss_end = getSize(bss);
+		m_data_end = m_bss_end + getSize(data);
+		m_dataRegion = new memsafe_data_entry[m_data_end];//fixed size
+		m_data_dirty.reset(m_data_end, 0);
+		m_data_dirty.markRange(0, m_data_end);
+		
+		for (int i = 0; i < m_bss_end; i++) {
+			bss_addresses.push_back(i + m_layout.BSS_START);
+			m_dataRegion[i] = bss[i];
+		}
+		for (int i = m_bss_end; i < m_data_end; i++) {
+			data_addresses.push_back((i-m_bss_end) + m_layout.DATA_START);
+			m_dataRegion[i] = data[i - m_bss_end];
+		}
+		
+		//next, populate dynamic region
+		m_dynamic_dirty.reset(m_layout.HEAP_SIZE, DIRTY_PAGE_SHIFT);
+		m_heap_pages.reset(m_layout.DYNAMIC_START, m_layout.HEAP_SIZE);
+		allocateBatch(dynamic, dynamic_size);//allocate necessary memory
+
+		//next, populate text
+		//m_text = new unsigned char[text_size];
+		m_text = text;//we will NOT be dynamically allocating a seperate copy for this assignment, it will be assumed that our allocator is responsible for 
+		m_text_end = text_size;
+		text_addresses_end = m_text_end + m_layout.TEXT_START;
+		m_text_dirty.reset(m_text_end, 0);
+		m_text_dirty.markRange(0, m_text_end);
+		m_text_pages.reset(m_layout.TEXT_START, m_text_end);
+		m_text_pages.promote(m_layout.TEXT_START, text_addresses_end);//text never changes after loading, so it's mapped large from the start
+		//memcpy(m_text, text, text_size);
+	}
+	/*
+	Runtime heap operations. These take and return simulated addresses, and keep dynamic_addresses up to date for printAddressSpaceInfo.
+	0 is returned on failure, since it is never a valid dynamic address.
+	*/
+	vaddr_t allocate(int amnt)
+	{
+		int offset = m_dynamic->allocate(amnt);
+		if (offset == -1)
+			return 0;
+		dynamic_addresses.push_back(offset + m_layout.DYNAMIC_START);
+		m_dynamic_dirty.mark(offset);
+		m_heap_events[dynamic_addresses.back()] = false;
+		mapLarge(dynamic_addresses.back(), amnt);
+		return dynamic_addresses.back();
+	}
+	std::vector<vaddr_t> allocateBatch(const int* sizes, int count)
+	{
+		//same as calling allocate for each size, but lets the engine do the whole list at once
+		std::vector<int> offsets = m_dynamic->allocateBatch(sizes, count);
+		std::vector<vaddr_t> addresses(count, 0);
+		for (int i = 0; i < count; i++)
+		{
+			if (offsets[i] == -1)
+				continue;
+			addresses[i] = offsets[i] + m_layout.DYNAMIC_START;
+			dynamic_addresses.push_back(addresses[i]);
+			m_dynamic_dirty.mark(offsets[i]);
+			m_heap_events[addresses[i]] = false;
+			mapLarge(addresses[i], sizes[i]);
+		}
+		return addresses;
+	}
+	void deallocate(vaddr_t address)
+	{
+		for (size_t i = 0; i < dynamic_addresses.size(); i++)
+		{
+			if (dynamic_addresses[i] == address)
+			{
+				m_dynamic->deallocate((int)(address - m_layout.DYNAMIC_START));
+				unmapLarge(address);
+				dynamic_addresses.erase(dynamic_addresses.begin() + i);
+				m_dynamic_dirty.mark((int)(address - m_layout.DYNAMIC_START));
+				m_heap_events[address] = true;
+				return;
+			}
+		}
+		std::cerr << "ERROR: ADDRESS WAS NOT ALLOCATED\n";
+	}
+	vaddr_t reallocate(vaddr_t address, int amnt)
+	{
+		for (size_t i = 0; i < dynamic_addresses.size(); i++)
+		{
+			if (dynamic_addresses[i] == address)
+			{
+				int offset = m_dynamic->reallocate((int)(address - m_layout.DYNAMIC_START), amnt);
+				if (offset == -1)
+					return 0;//the old block is left untouched
+				dynamic_addresses[i] = offset + m_layout.DYNAMIC_START;
+				unmapLarge(address);//demoted and promoted again, since the block may have moved or no longer cover the same superpages
+				mapLarge(dynamic_addresses[i], amnt);
+				m_dynamic_dirty.markRange(offset, amnt);//the block may have moved, so its whole contents count as changed
+				m_heap_events[address] = true;
+				m_heap_events[dynamic_addresses[i]] = false;
+				return dynamic_addresses[i];
+			}
+		}
+		std::cerr << "ERROR: ADDRESS WAS NOT ALLOCATED\n";
+		return 0;
+	}
+	/*
+	Checkpoint layout: header, layout, name, shared segment key, heap engine, then the stack, BSS/data and text contents, the dynamic addresses and the engine
+	metadata, all in one buffer. The heap bytes follow on the next page boundary, written straight from the data region.
+	*/
+	bool saveCheckpoint(const std::string& path)
+	{
+		std::string out;
+		out.append(CHECKPOINT_MAGIC, 4);
+		putRaw(out, (int)CHECKPOINT_VERSION);
+		putRaw(out, m_layout);
+		putString(out, m_processName);
+		putString(out, m_shareStruct != nullptr ? m_shareStruct->key : "");
+		putRaw(out, (int)m_heap_kind);
+		putRaw(out, m_stack.getCount());
+		for (int i = 0; i < m_stack.getCount(); i++)
+			putEntry(out, m_stack[i].dataType, m_stack[i].data);
+		putRaw(out, m_bss_end);
+		putRaw(out, m_data_end - m_bss_end);
+		for (int i = 0; i < m_data_end; i++)
+			putEntry(out, m_dataRegion[i].dataType, m_dataRegion[i].data);
+		putRaw(out, m_text_end);
+		out.append((const char*)m_text, m_text_end);
+		putRaw(out, (int)dynamic_addresses.size());
+		out.append((const char*)dynamic_addresses.data(), sizeof(vaddr_t) * dynamic_addresses.size());
+		putRaw(out, (int)m_large_blocks.size());
+		for (std::map<vaddr_t, int>::iterator it = m_large_blocks.begin(); it != m_large_blocks.end(); ++it)
+		{
+			putRaw(out, it->first);
+			putRaw(out, it->second);
+		}
+		m_dynamic->saveState(out);
+		out.resize((out.size() + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN, 0);
+
+		//written next to the target and renamed over it, since a restored space's heap is still a mapping of the file it came from
+		std::string temp = path + ".tmp";
+		std::ofstream ofs(temp, std::ios::binary | std::ios::trunc);
+		ofs.write(out.data(), out.size());
+		m_dynamic->writeRegion(ofs);
+		ofs.close();
+		if (!ofs)
+		{
+			std::cerr << "ERROR: COULD NOT WRITE CHECKPOINT " << path << "\n";
+			std::remove(temp.c_str());
+			return false;
+		}
+#ifdef _WIN32
+		std::remove(path.c_str());//rename doesn't replace an existing file here
+#endif
+		if (std::rename(temp.c_str(), path.c_str()) != 0)
+		{
+			std::cerr << "ERROR: COULD NOT WRITE CHECKPOINT " << path << "\n";
+			std::remove(temp.c_str());
+			return false;
+		}
+		return true;
+	}
+	static void discardEntries(std::vector<data_entry>& entries)
+	{
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			memsafe_data_entry discard(entries[i]);//frees the value on destruction
+		}
+	}
+	static AddressSpace* restoreCheckpoint(const std::string& path)
+	{
+		size_t size;
+		char* base = mapCheckpoint(path, size);
+		if (base == nullptr || size < 8 + sizeof(RuntimeLayout) || memcmp(base, CHECKPOINT_MAGIC, 4) != 0 || *(int*)(base + 4) != CHECKPOINT_VERSION)
+		{
+			std::cerr << "ERROR: INVALID CHECKPOINT " << path << "\n";
+			if (base != nullptr)
+				unmapCheckpoint(base, size);
+			return nullptr;
+		}
+		const char* in = base + 8;
+		bool bad_flag = (unsigned char)in[offsetof(RuntimeLayout, STACK_GROWS_DOWN)] > 1;//anything but 0 or 1 isn't a bool, so check the byte before reading it as one
+		RuntimeLayout layout = getRaw<RuntimeLayout>(in);
+		if (bad_flag || !layout.ordered() || (layout.HEAP_SIZE & (layout.HEAP_SIZE - 1)) != 0)
+		{
+			std::cerr << "ERROR: INVALID CHECKPOINT " << path << "\n";
+			unmapCheckpoint(base, size);
+			return nullptr;
+		}
+		size_t heap_offset = size - layout.HEAP_SIZE;//the heap is always the last thing in the file
+		if (size < (size_t)layout.HEAP_SIZE + CHECKPOINT_ALIGN || heap_offset % CHECKPOINT_ALIGN != 0)
+		{
+			std::cerr << "ERROR: TRUNCATED CHECKPOINT " << path << "\n";
+			unmapCheckpoint(base, size);
+			return nullptr;
+		}
+		//everything up to the heap is metadata, and every count and length in it is checked against that end before it's used
+		const char* end = base + heap_offset;
+		std::string name, key;
+		int kind, stack_count, bss_count, data_count, text_size = 0, dynamic_count, large_count;
+		std::vector<data_entry> stack, bss, data;
+		bool valid = readString(in, end, name) && readString(in, end, key) && readRaw(in, end, kind) && kind >= 0 && kind < A_COUNT
+			&& readRaw(in, end, stack_count) && stack_count <= layout.STACK_SIZE && readEntries(in, end, stack_count, stack)
+			&& readRaw(in, end, bss_count) && readRaw(in, end, data_count) && readEntries(in, end, bss_count, bss) && readEntries(in, end, data_count, data)
+			&& readRaw(in, end, text_size) && text_size >= 0 && end - in >= text_size;
+		const char* text = in;
+		std::vector<vaddr_t> dynamic;
+		std::vector<std::pair<vaddr_t, int>> large;
+		if (valid)
+		{
+			in += text_size;
+			valid = readRaw(in, end, dynamic_count) && dynamic_count >= 0 && dynamic_count <= (end - in) / (int)sizeof(vaddr_t);
+		}
+		for (int i = 0; valid && i < dynamic_count; i++)
+		{
+			dynamic.push_back(getRaw<vaddr_t>(in));
+			valid = dynamic.back() >= layout.DYNAMIC_START && dynamic.back() - layout.DYNAMIC_START < (vaddr_t)layout.HEAP_SIZE;
+		}
+		valid = valid && readRaw(in, end, large_count) && large_count >= 0;
+		for (int i = 0; valid && i < large_count; i++)
+		{
+			vaddr_t address;
+			int amnt;
+			valid = readRaw(in, end, address) && readRaw(in, end, amnt) && address >= layout.DYNAMIC_START && amnt > 0
+				&& address - layout.DYNAMIC_START < (vaddr_t)layout.HEAP_SIZE && (vaddr_t)amnt <= layout.HEAP_SIZE - (address - layout.DYNAMIC_START);
+			large.push_back(std::make_pair(address, amnt));
+		}
+		if (!valid)
+		{
+			discardEntries(stack);
+			discardEntries(bss);
+			discardEntries(data);
+			std::cerr << "ERROR: INVALID CHECKPOINT " << path << "\n";
+			unmapCheckpoint(base, size);
+			return nullptr;
+		}
+		if (key.empty())
+		{
+			//the process wasn't linked to any shared segments, so it gets its own key rather than sharing "" with every other such process
+			static int unshared = 0;
+			key = "UNSHARED" + std::to_string(unshared++);
+		}
 
-		int i = 0;
-		if (stack != nullptr) {
-			while (stack[i].dataType != T_VOID)
+		sharedData* share;
+		std::map<std::string, sharedData>::iterator found = programLinks.find(key);
+		if (found != programLinks.end() && found->second.num_using > 0)
+		{
+			//the shared segments are still loaded, so link to them and drop the copies from the checkpoint
+			share = &found->second;
+			discardEntries(bss);
+			discardEntries(data);
+		}
+		else
+		{
+			if (found != programLinks.end())
 			{
-				stack_addresses.push_back(STACK_START + i);
-				m_stack.push(stack[i]);
-				i++;
+				//left behind by processes that have all exited (their values and text went with the last one), only the entry arrays are still around
+				delete[] found->second.bss_r;
+				delete[] found->second.data_r;
 			}
+			sharedData restored;
+			restored.key = key;
+			restored.restored = true;
+			restored.bss_r = new data_entry[bss.size()];
+			restored.data_r = new data_entry[data.size()];
+			std::copy(bss.begin(), bss.end(), restored.bss_r);
+			std::copy(data.begin(), data.end(), restored.data_r);
+			restored.text_r = new unsigned char[text_size];
+			memcpy(restored.text_r, text, text_size);
+			restored.text_s = text_size;
+			programLinks[key] = restored;
+			share = &programLinks[key];
 		}
-		
-		//next, populate the BSS and data region
-		m_bss_end = getSize(bss);
-		m_data_end = m_bss_end + getSize(data);
-		m_dataRegion = new memsafe_data_entry[m_data_end];//fixed size
-		
-		for (int i = 0; i < m_bss_end; i++) {
-			bss_addresses.push_back(i + BSS_START);
-			m_dataRegion[i] = bss[i];
+
+		AddressSpace* space = buildForRestore(layout, stack.data(), share, (AllocatorKind)kind);
+		share->addProg(space);
+		space->setSharingData(share);
+		space->m_processName = name;
+		space->m_dynamic->adoptRegion(base + heap_offset);//no copy, pages are faulted in from the file on first access
+		space->m_checkpoint = base;
+		space->m_checkpoint_size = size;
+		valid = space->m_dynamic->loadState(in, end);
+		for (size_t i = 0; valid && i < dynamic.size(); i++)
+			valid = space->m_dynamic->isAllocated((int)(dynamic[i] - layout.DYNAMIC_START));
+		if (!valid)
+		{
+			std::cerr << "ERROR: INVALID CHECKPOINT " << path << "\n";
+			delete space;//unmaps the file, and frees the shared segments if nothing else uses them
+			return nullptr;
 		}
-		for (int i = m_bss_end; i < m_data_end; i++) {
-			data_addresses.push_back((i-m_bss_end) + DATA_START);
-			m_dataRegion[i] = data[i - m_bss_end];
+		space->dynamic_addresses = dynamic;
+		for (vaddr_t c : space->dynamic_addresses)
+		{
+			space->m_dynamic_dirty.mark((int)(c - layout.DYNAMIC_START));
+			space->m_heap_events[c] = false;
 		}
-		
-		//next, populate dynamic region
-		for (int i = 0; i < dynamic_size; i++)
-			dynamic_addresses.push_back(m_dynamic.allocate(dynamic[i])+DYNAMIC_START);//allocate necessary memory
-
-		//next, populate text
-		//m_text = new unsigned char[text_size];
-		m_text = text;//we will NOT be dynamically allocating a seperate copy for this assignment, it will be assumed that our allocator is responsible for 
-		m_text_end = text_size;
-		text_addresses_end = m_text_end + TEXT_START;
-		//memcpy(m_text, text, text_size);
+		for (size_t i = 0; i < large.size(); i++)
+			space->mapLarge(large[i].first, large[i].second);
+		return space;
 	}
 	std::string getSharedDataString()
 	{
@@ -563,88 +2740,354 @@ public:
 		
 		return c.str();
 	}
+	void* inspectAddress(vaddr_t index) {
+		//for the dumps: the plain variant, so looking at the space doesn't show up in the TLB or profiler counts it's reporting on
+		return (this->*m_access_variants[0])(index);
+	}
+	std::string entryString(vaddr_t address) {
+		//inspectAddress gives nullptr for anything that couldn't be paged in, so the dumps say so instead of dereferencing it
+		memsafe_data_entry* entry = (memsafe_data_entry*)inspectAddress(address);
+		return entry != nullptr ? entry->toString() : "NOT MAPPED";
+	}
+	std::string heapBlockString(vaddr_t address) {
+		int* size = (int*)inspectAddress(address);
+		return size != nullptr ? "ALLOCATED TO ALLOW " + std::to_string(*size) + " BYTES AT THIS ADDRESS" : "NOT MAPPED";
+	}
 	void printAddressSpaceInfo() {
 		std::cout << "------------------------------"<< m_processName<< " ADDRESS SPACE------------------------------\n";
 		std::cout << "TEXT REGION INFO "<<getSharedDataString() <<":\n\n[...]\n";
-		for (int i = TEXT_START; i < text_addresses_end; i++)
-			std::cout << std::hex << "[0x" << i << "] - " << "["  << "0x" <<(int)*(unsigned char*)accessAddress(i) << std::dec <<"]\n";
+		for (vaddr_t i = m_layout.TEXT_START; i < text_addresses_end; i++)
+			std::cout << std::hex << "[0x" << i << "] - " << "["  << "0x" <<(int)*(unsigned char*)inspectAddress(i) << std::dec <<"]\n";//text is never paged
 		std::cout << "[...]\n";
 		
 		std::cout << "\nDATA REGION INFO "<<getSharedDataString()<<":\n\n";
 		std::cout << "--------------BSS--------------\n[...]\n";
-		for (int c : bss_addresses)
-			std::cout << std::hex << "[0x" << c << "] - " << "[" << ((memsafe_data_entry*)accessAddress(c))->toString() << std::dec << "]\n";
+		for (vaddr_t c : bss_addresses)
+			std::cout << std::hex << "[0x" << c << "] - " << "[" << entryString(c) << std::dec << "]\n";
 		std::cout << "[...]\n-------------DATA--------------\n[...]\n";
-		for (int c : data_addresses)
-			std::cout << std::hex << "[0x" << c << "] - " << "[" << ((memsafe_data_entry*)accessAddress(c))->toString() << std::dec << "]\n";
+		for (vaddr_t c : data_addresses)
+			std::cout << std::hex << "[0x" << c << "] - " << "[" << entryString(c) << std::dec << "]\n";
 		std::cout << "[...]\n";
 		
 		std::cout << "\nDYNAMIC REGION INFO:\n\n";
-		std::cout << "BUDDY LAYOUT (NUMBERS ARE OFFSETS):\n";
-		m_dynamic.print_nodes();
+		std::cout << m_dynamic->getName() << " LAYOUT (NUMBERS ARE OFFSETS):\n";
+		m_dynamic->print_nodes();
 		std::cout << "[...]\n";
-		for (int c : dynamic_addresses)
-			std::cout << std::hex << "[0x" << c << "] - " << "[ALLOCATED TO ALLOW " << std::dec << *(int*)accessAddress(c) << " BYTES AT THIS ADDRESS]\n";
+		for (vaddr_t c : dynamic_addresses)
+			std::cout << std::hex << "[0x" << c << "] - " << "[" << heapBlockString(c) << std::dec << "]\n";
 		std::cout << "[...]\n";
 
 		std::cout << "\nSTACK REGION INFO:\n\n[...]\n";
-		for (int c : stack_addresses)
-			std::cout << std::hex << "[0x" << c << "] - " << "[" << ((memsafe_data_entry*)accessAddress(c))->toString() << std::dec << "]\n";
+		for (vaddr_t c : stack_addresses)
+			std::cout << std::hex << "[0x" << c << "] - " << "[" << entryString(c) << std::dec << "]\n";
 		std::cout << "[...]\n";
-		
+		clearDirty();
 	}
 	/*
 	the objective here is to create an address space s.t. there is a seperate set of addresses (indexes) which refer to global addresses (pointers in our case)
 	this index will serve as a key (local address) to the some peice of data in memory, we can keep track of a list of taken indexes, then assign the these taken addresses
 	to peices in memory
+
+	Heap pointers are only good up to the end of their 4 KB page (FRAME_SIZE), since the heap is paged in from the frame pool and its pages aren't contiguous.
+	Anything spanning pages has to be accessed a page at a time. A space restored from a checkpoint happens to be contiguous, but don't rely on it.
+	Returns nullptr for an address outside every region, or a page that couldn't be paged in (the process is over its frame quota).
 	*/
-	void* accessAddress(unsigned int index) {
+	void* accessAddress(vaddr_t index) {
 		//return the real pointer to the relevant address using the local address
-		if (TEXT_START <= index && index < BSS_START) {
-			//access text
-			short local_index = (short)(index - TEXT_START);
-			if (local_index < m_text_end)
-				return m_text + local_index;
-			else
-				return nullptr;
+		return (this->*m_access)(index);
+	}
+	void* accessAddressForWrite(vaddr_t index) {
+		//same as accessAddress (and the same page rule), but the caller intends to write through the pointer, so the location is marked dirty
+		return (this->*m_access_write)(index);
+	}
+#ifdef PROFILE_ACCESSES
+	template<bool WRITE, bool TLB, class L>
+	PROFILE_COLD void* accessSampled(const L& layout, vaddr_t index) {
+		//the access the countdown ran out on: done unprofiled, then recorded if it landed somewhere
+		void* data = accessIn<WRITE, false, TLB>(layout, index);
+		if (data == nullptr)
+		{
+			m_sample_countdown = 1;//nothing to record, so sample the next one instead
+			return nullptr;
 		}
-		else if (BSS_START <= index && index < DATA_START) {
-			//access bss
-			unsigned int local_index = index - BSS_START;
-			if (local_index < m_bss_end)
-				return m_dataRegion + local_index;
-			else
-				return nullptr;
+		int region = layout.regionOf(index);
+		vaddr_t local_index;
+		switch (region)
+		{
+		case R_TEXT: local_index = index - layout.TEXT_START; break;
+		case R_BSS: local_index = index - layout.BSS_START; break;
+		case R_DATA: local_index = index - layout.DATA_START; break;
+		case R_DYNAMIC: local_index = index - layout.DYNAMIC_START; break;
+		default: local_index = layout.STACK_GROWS_DOWN ? layout.STACK_END - 1 - index : index - layout.STACK_START; break;
 		}
-		else if (DATA_START <= index && index < DYNAMIC_START) {
-			//access data
-			unsigned int local_index = (index - DATA_START)+m_bss_end;
-			if (local_index < m_data_end)
-				return m_dataRegion + local_index;
-			else
-				return nullptr;
+		m_sample_countdown = m_profiler->sample(region, local_index, index);
+		return data;
+	}
+#endif
+	template<bool WRITE, bool PROFILE, bool TLB, class L>
+	void* accessIn(const L& layout, vaddr_t index) {
+		PROFILE_ACCESS(layout, index);//a single countdown, the cold path does the bookkeeping
+		vaddr_t local_index;
+		switch (layout.regionOf(index))
+		{
+		case R_TEXT:
+			local_index = index - layout.TEXT_START;
+			if (local_index >= (vaddr_t)m_text_end) return nullptr;
+			if (WRITE) m_text_dirty.mark((int)local_index);
+			if (TLB) m_tlb->translate(index, m_text_pages.isHuge(index));
+			return m_text + local_index;
+		case R_BSS:
+			local_index = index - layout.BSS_START;
+			if (local_index >= (vaddr_t)m_bss_end) return nullptr;
+			if (WRITE) m_data_dirty.mark((int)local_index);
+			if (TLB) m_tlb->translate(index, false);
+			return m_dataRegion + local_index;
+		case R_DATA:
+			local_index = (index - layout.DATA_START) + m_bss_end;
+			if (local_index >= (vaddr_t)m_data_end) return nullptr;
+			if (WRITE) m_data_dirty.mark((int)local_index);
+			if (TLB) m_tlb->translate(index, false);
+			return m_dataRegion + local_index;
+		case R_DYNAMIC:
+			local_index = index - layout.DYNAMIC_START;
+			if (local_index >= (vaddr_t)layout.HEAP_SIZE) return nullptr;
+			if (WRITE) m_dynamic_dirty.mark((int)local_index);
+			if (TLB) m_tlb->translate(index, m_heap_pages.isHuge(index));
+			return m_dynamic->accessData((int)local_index);
+		case R_STACK:
+			local_index = layout.STACK_GROWS_DOWN ? layout.STACK_END - 1 - index : index - layout.STACK_START;
+			if (local_index >= (vaddr_t)m_stack.getCount()) return nullptr;//slots above the head hold nothing yet
+			if (WRITE) m_stack_dirty.mark((int)local_index);
+			if (TLB) m_tlb->translate(index, false);
+			return &m_stack[(int)local_index];
+		default:
+			//otherwise, the user is attempting to access a null pointer, which is impossible
+			std::cerr << "ERROR: CANNOT ACCESS NULL POINTER" << std::endl;
+			return nullptr;
 		}
-		else if (DYNAMIC_START <= index && index < STACK_START) {
-			//access dynamic
-			unsigned int local_index = index - DYNAMIC_START;
-			if (local_index < DEFAULT_HEAP_SIZE)
-				return m_dynamic.accessData(local_index);
-			else
-				return nullptr;
+	}
+	template<class L, bool WRITE, bool PROFILE, bool TLB>
+	void* accessStatic(vaddr_t index) {
+		return accessIn<WRITE, PROFILE, TLB>(L(), index);//L only has static members, so this folds down to constants
+	}
+	template<bool WRITE, bool PROFILE, bool TLB>
+	void* accessRuntime(vaddr_t index) {
+		return accessIn<WRITE, PROFILE, TLB>(m_layout, index);
+	}
+	template<class L, bool PROFILE, bool TLB>
+	void bindStatic() {
+		m_access_variants[(PROFILE ? 2 : 0) | (TLB ? 4 : 0)] = &AddressSpace::accessStatic<L, false, PROFILE, TLB>;
+		m_access_variants[(PROFILE ? 2 : 0) | (TLB ? 4 : 0) | 1] = &AddressSpace::accessStatic<L, true, PROFILE, TLB>;
+	}
+	template<bool PROFILE, bool TLB>
+	void bindRuntime() {
+		m_access_variants[(PROFILE ? 2 : 0) | (TLB ? 4 : 0)] = &AddressSpace::accessRuntime<false, PROFILE, TLB>;
+		m_access_variants[(PROFILE ? 2 : 0) | (TLB ? 4 : 0) | 1] = &AddressSpace::accessRuntime<true, PROFILE, TLB>;
+	}
+	template<class L>
+	RuntimeLayout bindLayout(const L&) {
+		static_assert((L::HEAP_SIZE & (L::HEAP_SIZE - 1)) == 0, "the heap size must be a power of 2");
+		bindStatic<L, false, false>();
+		bindStatic<L, false, true>();
+#ifdef PROFILE_ACCESSES
+		bindStatic<L, true, false>();
+		bindStatic<L, true, true>();
+#endif
+		m_access = m_access_variants[0];
+		m_access_write = m_access_variants[1];
+		return RuntimeLayout::of<L>();
+	}
+	RuntimeLayout bindLayout(const RuntimeLayout& layout) {
+		bindRuntime<false, false>();
+		bindRuntime<false, true>();
+#ifdef PROFILE_ACCESSES
+		bindRuntime<true, false>();
+		bindRuntime<true, true>();
+#endif
+		m_access = m_access_variants[0];
+		m_access_write = m_access_variants[1];
+		if (!layout.ordered())
+		{
+			std::cerr << "ERROR: INVALID LAYOUT, USING THE CLASSIC LAYOUT INSTEAD" << std::endl;
+			return RuntimeLayout::of<ClassicLayout>();
+		}
+		RuntimeLayout checked = layout;
+		if (checked.HEAP_SIZE & (checked.HEAP_SIZE - 1))
+		{
+			//the buddy engine needs a power of 2, rounding down keeps the heap clear of the stack
+			while (checked.HEAP_SIZE & (checked.HEAP_SIZE - 1))
+				checked.HEAP_SIZE &= checked.HEAP_SIZE - 1;
+			std::cerr << "ERROR: HEAP SIZE IS NOT A POWER OF 2, ROUNDED DOWN TO " << checked.HEAP_SIZE << std::endl;
 		}
-		else if (STACK_START <= index) {
-			//access stack
-			unsigned int local_index = index - STACK_START;
-			if (local_index < m_stack.getMax())
-				return &m_stack[local_index];
+		return checked;
+	}
+	void rebindAccess() {
+		//picks the instantiation with exactly the hooks that are attached
+		int hooks = m_tlb != nullptr ? 4 : 0;
+#ifdef PROFILE_ACCESSES
+		hooks |= m_profiler != nullptr ? 2 : 0;
+#endif
+		m_access = m_access_variants[hooks];
+		m_access_write = m_access_variants[hooks | 1];
+	}
+	void mapLarge(vaddr_t address, int amnt) {
+		//heap blocks that could cover a whole superpage are remembered, and promoted while superpages are on
+		if ((vaddr_t)amnt < SUPERPAGE_SIZE)
+			return;
+		m_large_blocks[address] = amnt;
+		if (m_superpages && m_heap_pages.promote(address, address + amnt) != 0 && m_tlb != nullptr)
+			m_tlb->invalidate(address, address + amnt);
+	}
+	void unmapLarge(vaddr_t address) {
+		std::map<vaddr_t, int>::iterator found = m_large_blocks.find(address);
+		if (found == m_large_blocks.end())
+			return;
+		if (m_heap_pages.demote(address, address + found->second) != 0 && m_tlb != nullptr)
+			m_tlb->invalidate(address, address + found->second);
+		m_large_blocks.erase(found);
+	}
+	FrameAccount& getFrameAccount() { return m_frame_account; }
+	HeapAllocator* getHeap() { return m_dynamic; }
+	void printFrameUsage() {
+		std::cout << m_processName << " FRAMES: " << m_frame_account.used.load() << " IN USE, PEAK " << m_frame_account.peak.load();
+		if (m_frame_account.quota >= 0)
+			std::cout << " OF " << m_frame_account.quota;
+		std::cout << ", " << m_frame_account.denied.load() << " DENIED" << std::endl;
+	}
+	void enableTlb(int base_entries = 64, int super_entries = 32)
+	{
+		disableTlb();
+		m_tlb = new TlbModel(base_entries, super_entries);
+		rebindAccess();
+	}
+	void disableTlb()
+	{
+		delete m_tlb;
+		m_tlb = nullptr;
+		rebindAccess();
+	}
+	TlbModel* getTlb() { return m_tlb; }
+	void setSuperpages(bool enabled)
+	{
+		//turning superpages off demotes every mapping back to base pages, turning them on promotes whatever qualifies again
+		if (enabled == m_superpages)
+			return;
+		m_superpages = enabled;
+		if (enabled)
+			m_text_pages.promote(m_layout.TEXT_START, text_addresses_end);
+		else
+			m_text_pages.demote(m_layout.TEXT_START, text_addresses_end);
+		for (std::map<vaddr_t, int>::iterator it = m_large_blocks.begin(); it != m_large_blocks.end(); ++it)
+		{
+			if (enabled)
+				m_heap_pages.promote(it->first, it->first + it->second);
 			else
-				return nullptr;
+				m_heap_pages.demote(it->first, it->first + it->second);
 		}
-		else {
-			//otherwise, the user is attempting to access a null pointer, which is impossible
-			std::cerr << "ERROR: CANNOT ACCESS NULL POINTER" << std::endl;
+		if (m_tlb != nullptr)
+		{
+			m_tlb->invalidate(m_layout.TEXT_START, text_addresses_end);
+			m_tlb->invalidate(m_layout.DYNAMIC_START, m_layout.DYNAMIC_START + m_layout.HEAP_SIZE);
+		}
+	}
+	int getSuperpageCount() { return m_text_pages.count() + m_heap_pages.count(); }
+	void printTranslationStats()
+	{
+		std::cout << "------------------------------" << m_processName << " TRANSLATION------------------------------\n";
+		std::cout << "SUPERPAGES: " << m_text_pages.count() << " TEXT, " << m_heap_pages.count() << " HEAP ("
+			<< m_text_pages.getPromotions() + m_heap_pages.getPromotions() << " PROMOTED, "
+			<< m_text_pages.getDemotions() + m_heap_pages.getDemotions() << " DEMOTED)\n";
+		if (m_tlb != nullptr)
+			m_tlb->print();
+	}
+	void clearDirty() {
+		//everything printed so far is the baseline for the next diff
+		m_text_dirty.take();
+		m_data_dirty.take();
+		m_dynamic_dirty.take();
+		m_stack_dirty.take();
+		m_heap_events.clear();
+		m_epoch++;
+	}
+	int getEpoch() { return m_epoch; }
+#ifdef PROFILE_ACCESSES
+	void enableProfiling(int sample_every = 64, int page_shift = 8)
+	{
+		//page_shift sets the page size the counts are kept at, so different page sizes can be compared on the same run
+		int sizes[R_COUNT] = { 0, m_text_end, m_bss_end, m_data_end - m_bss_end, m_layout.HEAP_SIZE, m_layout.STACK_SIZE };
+		disableProfiling();
+		m_profiler = new AccessProfiler(m_layout, sizes, sample_every, page_shift);
+		m_sample_countdown = m_profiler->getSampleEvery();
+		rebindAccess();
+	}
+	void disableProfiling()
+	{
+		if (m_profiler == nullptr)
+			return;
+		delete m_profiler;
+		m_profiler = nullptr;
+		rebindAccess();
+	}
+	AccessProfiler* getProfiler() { return m_profiler; }
+	void printAccessProfile(int top_n = 10)
+	{
+		if (m_profiler == nullptr)
+			return;
+		std::cout << "------------------------------" << m_processName << " ACCESS PROFILE------------------------------\n";
+		m_profiler->printHeatmap();
+		std::cout << "\nHOTTEST PAGES:\n";
+		m_profiler->printHotPages(top_n);
+	}
+#endif
+	/*
+	Prints only what changed since the last dump, in the same format as printAddressSpaceInfo. The cost depends on how much was written, not on the size
+	of the address space: the dirty maps hand back just the units that changed, and heap blocks come from the allocation events.
+	*/
+	void printAddressSpaceDiff() {
+		std::cout << "------------------------------" << m_processName << " ADDRESS SPACE CHANGES (EPOCH " << m_epoch << ")------------------------------\n";
+		std::vector<int> text = m_text_dirty.take();
+		if (!text.empty())
+		{
+			std::cout << "TEXT REGION CHANGES " << getSharedDataString() << ":\n";
+			for (int i : text)
+				std::cout << std::hex << "[0x" << i + m_layout.TEXT_START << "] - " << "[" << "0x" << (int)m_text[i] << std::dec << "]\n";
+		}
+		std::vector<int> data = m_data_dirty.take();
+		if (!data.empty())
+		{
+			std::cout << "DATA REGION CHANGES " << getSharedDataString() << ":\n";
+			for (int i : data)
+			{
+				vaddr_t c = i < m_bss_end ? i + m_layout.BSS_START : (i - m_bss_end) + m_layout.DATA_START;
+				std::cout << std::hex << "[0x" << c << "] - " << "[" << (i < m_bss_end ? "BSS " : "DATA ") << m_dataRegion[i].toString() << std::dec << "]\n";
+			}
+		}
+		std::vector<int> pages = m_dynamic_dirty.take();
+		if (!pages.empty() || !m_heap_events.empty())
+		{
+			std::cout << "DYNAMIC REGION CHANGES:\n";
+			for (std::map<vaddr_t, bool>::iterator e = m_heap_events.begin(); e != m_heap_events.end(); e++)
+			{
+				if (e->second)
+					std::cout << std::hex << "[0x" << e->first << "] - " << "[FREED]" << std::dec << "\n";
+				else
+					std::cout << std::hex << "[0x" << e->first << "] - " << "[" << heapBlockString(e->first) << std::dec << "]\n";
+			}
+			int page = m_dynamic_dirty.unitSize();
+			for (int p : pages)
+				std::cout << std::hex << "[0x" << p * page + m_layout.DYNAMIC_START << " - 0x" << (p + 1) * page - 1 + m_layout.DYNAMIC_START << "] - [MODIFIED]" << std::dec << "\n";
+			m_heap_events.clear();
+		}
+		std::vector<int> stack = m_stack_dirty.take();
+		if (!stack.empty())
+		{
+			std::cout << "STACK REGION CHANGES:\n";
+			for (int i : stack)
+				std::cout << std::hex << "[0x" << m_layout.stackAddress(i) << "] - " << "[" << (i < m_stack.getCount() ? m_stack[i].toString() : "EMPTY") << std::dec << "]\n";
 		}
+		m_epoch++;
 	}
+	const RuntimeLayout& getLayout() { return m_layout; }
 	~AddressSpace()
 	{
 		//there's a minor issue here: these entries de-allocate each other's data if we're sharing it, which leads to an error upon application close
@@ -660,11 +3103,24 @@ public:
 			//all of this could likely have been solved with smart pointers
 		}
 		delete[] m_dataRegion;
+		delete m_dynamic;
+		if (m_checkpoint != nullptr)
+			unmapCheckpoint(m_checkpoint, m_checkpoint_size);
+#ifdef PROFILE_ACCESSES
+		delete m_profiler;
+#endif
+		delete m_tlb;
 		m_shareStruct->notifyLeave();
+		if (m_shareStruct->restored && m_shareStruct->num_using == 0)
+		{
+			//the values and text were freed above, only the arrays holding them are left
+			delete[] m_shareStruct->bss_r;
+			delete[] m_shareStruct->data_r;
+			programLinks.erase(m_shareStruct->key);
+		}
 	}
 };
 
-std::map<std::string, sharedData> programLinks;
 class DataLoader {
 public:
 	const std::regex int_regex = std::regex("0|(-?[1-9][0-9]*)", std::regex::nosubs);
@@ -803,6 +3259,7 @@ public:
 			newSharedDataStruct.data_r = data_r;
 			newSharedDataStruct.text_r = text_r;
 			newSharedDataStruct.text_s = t_size;
+			newSharedDataStruct.key = fpath;
 			programLinks[fpath] = newSharedDataStruct;//copy our new data struct into the map
 			sharedDataStruct = &(programLinks[fpath]);//retrieve the address of our copied entry in the map
 		}
@@ -843,6 +3300,654 @@ void address_space_allocation(const std::string &path1, const std::string &path2
 	loader.initAddressSpace(p2, path2);
 	loader.initAddressSpace(p3, path3);
 }
+/*
+Benchmarks, run with the --bench flag. Each one builds its address spaces directly (no .txt files) so the numbers only reflect the code being measured.
+*/
+struct BenchTimer {
+	std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+	double elapsedMs() {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+	}
+};
+struct BenchProgram {
+	//owns the inputs and the shared data struct for one benchmark address space
+	data_entry stack[5], bss[3], data[3];
+	int dynamic[3] = { 900, 50, 10 };
+	sharedData share;
+	BenchProgram() {
+		for (int i = 0; i < 4; i++)
+		{
+			stack[i] = data_entry(new int(i), T_INT);
+			if (i < 2)
+			{
+				bss[i] = data_entry(new int(i), T_INT);
+				data[i] = data_entry(new float((float)i), T_FL);
+			}
+		}
+	}
+	template<class L>
+	AddressSpace* build(const L& layout, int text_size = 4096, const std::vector<int>* heap_objects = nullptr, AllocatorKind kind = A_BUDDY) {
+		unsigned char* text = new unsigned char[text_size];
+		for (int i = 0; i < text_size; i++)
+			text[i] = (unsigned char)i;
+		AddressSpace* space = heap_objects == nullptr
+			? new AddressSpace(stack, dynamic, 3, bss, data, text, text_size, layout, kind)
+			: new AddressSpace(stack, (int*)heap_objects->data(), (int)heap_objects->size(), bss, data, text, text_size, layout, kind);
+		share.addProg(space);
+		space->setSharingData(&share);
+		return space;
+	}
+};
+template<class L>
+double benchAccess(const L& layout, int rounds) {
+	BenchProgram prog;
+	AddressSpace* space = prog.build(layout);
+	RuntimeLayout r = space->getLayout();
+	//a mix of addresses from every region, so the region dispatch can't be predicted from a single hot branch
+	vaddr_t addresses[] = { r.TEXT_START + 7, r.BSS_START + 1, r.DYNAMIC_START + 64, r.DATA_START, r.TEXT_START + 4000, r.stackAddress(3), r.DYNAMIC_START + 1024, r.BSS_START };
+	const int n = sizeof(addresses) / sizeof(addresses[0]);
+	unsigned long long sink = 0;
+	BenchTimer t;
+	for (int i = 0; i < rounds; i++)
+		sink += (unsigned long long)space->accessAddress(addresses[(i * 5) % n]);
+	double ms = t.elapsedMs();
+	if (sink == 1) std::cout << "";//keeps the loop from being optimized away
+	delete space;
+	return ms;
+}
+void benchLayouts() {
+	const int rounds = 20000000;
+	std::cout << "ACCESS ADDRESS (" << rounds << " ACCESSES):\n";
+	std::cout << "  ClassicLayout (static)  : " << benchAccess(ClassicLayout(), rounds) << " ms\n";
+	std::cout << "  Layout32 (static)       : " << benchAccess(Layout32(), rounds) << " ms\n";
+	std::cout << "  Layout64 (static)       : " << benchAccess(Layout64(), rounds) << " ms\n";
+	std::cout << "  ClassicLayout (runtime) : " << benchAccess(RuntimeLayout::of<ClassicLayout>(), rounds) << " ms\n";
+	std::cout << "  Layout32 (runtime)      : " << benchAccess(RuntimeLayout::of<Layout32>(), rounds) << " ms\n";
+}
+struct BenchRandom {
+	//small LCG so every engine sees exactly the same sequence of requests
+	unsigned int m_state = 12345;
+	int next(int bound) {
+		m_state = m_state * 1103515245u + 12345u;
+		return (int)((m_state >> 8) % (unsigned int)bound);
+	}
+};
+struct AllocatorBenchResult {
+	const char* name = "";
+	double ms = 0;
+	int failed = 0;
+	int corrupt = 0;//live blocks whose size header was overwritten by another allocation
+};
+AllocatorBenchResult benchAllocator(AllocatorKind kind, int workload, int rounds) {
+	AllocatorBenchResult result;
+	HeapAllocator* heap = makeHeapAllocator(kind, DEFAULT_HEAP_SIZE);
+	result.name = heap->getName();
+	std::vector<int> live, sizes;
+	BenchRandom rnd;
+	std::streambuf* err = std::cerr.rdbuf(nullptr);//failed allocations are counted, not printed
+	BenchTimer t;
+	for (int r = 0; r < rounds; r++)
+	{
+		if (workload == 0)
+		{
+			//small fixed size objects, allocated in a burst then freed together
+			for (int i = 0; i < 64; i++)
+			{
+				int off = heap->allocate(24);
+				if (off == -1) result.failed++;
+				else { live.push_back(off); sizes.push_back(24); }
+			}
+		}
+		else if (workload == 1)
+		{
+			//mixed sizes with random frees, keeping around 32 blocks alive
+			for (int i = 0; i < 64; i++)
+			{
+				if (live.size() >= 32 || (!live.empty() && rnd.next(3) == 0))
+				{
+					int victim = rnd.next((int)live.size());
+					heap->deallocate(live[victim]);
+					live[victim] = live.back();
+					sizes[victim] = sizes.back();
+					live.pop_back();
+					sizes.pop_back();
+				}
+				int size = 8 + rnd.next(505);
+				int off = heap->allocate(size);
+				if (off == -1) result.failed++;
+				else { live.push_back(off); sizes.push_back(size); }
+			}
+		}
+		else
+		{
+			//growing sizes freed in reverse (stack-like lifetimes)
+			for (int i = 1; i <= 16; i++)
+			{
+				int off = heap->allocate(i * 48);
+				if (off == -1) result.failed++;
+				else { live.push_back(off); sizes.push_back(i * 48); }
+			}
+		}
+		for (size_t i = 0; i < live.size(); i++)
+			if (*(int*)heap->accessData(live[i]) != sizes[i])
+				result.corrupt++;
+		if (workload != 1)
+		{
+			while (!live.empty())
+			{
+				heap->deallocate(live.back());
+				live.pop_back();
+			}
+			sizes.clear();
+		}
+	}
+	result.ms = t.elapsedMs();
+	std::cerr.rdbuf(err);
+	delete heap;
+	return result;
+}
+/*
+Conformance checks every engine has to pass, in both a contiguous and a frame backed region: blocks never overlap (each one is filled with its own pattern
+and checked after everything else was allocated), running out returns -1, double and interior frees are refused without touching the heap, and reallocate
+keeps the contents up to the smaller of the two sizes.
+*/
+bool fillBlock(HeapAllocator* heap, int offset, int length, unsigned char value, bool check) {
+	//a page at a time, since a frame backed region is only contiguous within a page
+	for (int i = 0; i < length;)
+	{
+		int chunk = length - i < FRAME_SIZE - ((offset + i) & (FRAME_SIZE - 1)) ? length - i : FRAME_SIZE - ((offset + i) & (FRAME_SIZE - 1));
+		unsigned char* bytes = (unsigned char*)heap->accessData(offset + i);
+		if (bytes == nullptr)
+			return false;
+		for (int j = 0; j < chunk; j++)
+		{
+			if (!check)
+				bytes[j] = value;
+			else if (bytes[j] != value)
+				return false;
+		}
+		i += chunk;
+	}
+	return true;
+}
+int countErrors(std::stringstream& errors, const std::string& what) {
+	std::string text = errors.str();
+	int count = 0;
+	for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1))
+		count++;
+	errors.str("");
+	return count;
+}
+std::vector<std::string> checkAllocator(HeapAllocator* heap) {
+	std::vector<std::string> problems;
+	std::stringstream errors;
+	std::streambuf* err = std::cerr.rdbuf(errors.rdbuf());
+	if (heap->allocate(0) != -1 || heap->allocate(-5) != -1)
+		problems.push_back("size of 0 or less accepted");
+	errors.str("");
+	BenchRandom rnd;
+	std::vector<int> offsets, sizes;
+	std::vector<unsigned char> patterns;
+	//fill until the heap runs out
+	int offset = 0;
+	for (int i = 0; i < 4096 && offset != -1; i++)
+	{
+		int size = 4 + rnd.next(600);
+		if ((offset = heap->allocate(size)) == -1)
+			break;
+		offsets.push_back(offset);
+		sizes.push_back(size);
+		patterns.push_back((unsigned char)(offsets.size() * 37 + 1));
+		fillBlock(heap, offset, size, patterns.back(), false);
+	}
+	if (offset != -1 || countErrors(errors, "NOT ENOUGH MEMORY") != 1)
+		problems.push_back("exhaustion not reported");
+	if (offsets.size() < 4)
+	{
+		std::cerr.rdbuf(err);
+		problems.push_back("too few blocks");
+		return problems;
+	}
+	for (size_t i = 0; i < offsets.size(); i++)
+	{
+		if (!fillBlock(heap, offsets[i], sizes[i], patterns[i], true))
+		{
+			problems.push_back("overlapping blocks");
+			break;
+		}
+	}
+	for (size_t i = 0; i < offsets.size(); i++)
+		*(int*)heap->accessData(offsets[i]) = sizes[i];//engines read their size header back on free, so it goes back in before any block is freed
+	//double and interior frees
+	heap->deallocate(offsets[0]);
+	heap->deallocate(offsets[0]);
+	if (countErrors(errors, "INVALID FREE") != 1)
+		problems.push_back("double free accepted");
+	int first = heap->allocate(sizes[0]);
+	int second = heap->allocate(sizes[0]);
+	if (first != -1 && first == second)
+		problems.push_back("double free handed out the same block twice");
+	if (second != -1)
+		heap->deallocate(second);
+	if (first != -1)
+		heap->deallocate(first);
+	errors.str("");
+	heap->deallocate(offsets[1] + 4);
+	heap->deallocate(offsets[1] + 16);
+	if (countErrors(errors, "INVALID FREE") != 2)
+		problems.push_back("interior free accepted");
+	if (heap->reallocate(offsets[1] + 4, 64) != -1 || heap->reallocate(offsets[0], 64) != -1)
+		problems.push_back("reallocate of a block that isn't live accepted");
+	errors.str("");
+	offsets.erase(offsets.begin());
+	sizes.erase(sizes.begin());
+	patterns.erase(patterns.begin());
+	for (size_t i = 0; i < offsets.size(); i++)
+	{
+		if (!fillBlock(heap, offsets[i] + 4, sizes[i] - 4, patterns[i], true))
+		{
+			problems.push_back("rejected free changed the heap");
+			break;
+		}
+	}
+	//free every other block to make room, then grow or shrink the rest
+	for (size_t i = 0; i < offsets.size(); i++)
+	{
+		if (i & 1)
+		{
+			heap->deallocate(offsets[i]);
+			offsets[i] = -1;
+		}
+	}
+	for (size_t i = 0; i < offsets.size(); i++)
+	{
+		if (offsets[i] == -1)
+			continue;
+		int size = i % 4 == 0 ? sizes[i] * 2 + 50 : sizes[i] / 2 + 4;
+		int moved = heap->reallocate(offsets[i], size);
+		int kept = (moved == -1 ? sizes[i] : (size < sizes[i] ? size : sizes[i])) - 4;
+		if (!fillBlock(heap, (moved == -1 ? offsets[i] : moved) + 4, kept, patterns[i], true))
+			problems.push_back("reallocate lost contents");
+		if (moved == -1)
+			continue;
+		offsets[i] = moved;
+		sizes[i] = size;
+		fillBlock(heap, moved + 4, size - 4, patterns[i], false);
+	}
+	for (size_t i = 0; i < offsets.size(); i++)
+	{
+		if (offsets[i] != -1 && !fillBlock(heap, offsets[i] + 4, sizes[i] - 4, patterns[i], true))
+		{
+			problems.push_back("overlapping blocks after reallocate");
+			break;
+		}
+	}
+	for (size_t i = 0; i < offsets.size(); i++)
+		if (offsets[i] != -1)
+			heap->deallocate(offsets[i]);
+	if (countErrors(errors, "INVALID FREE") != 0)
+		problems.push_back("valid free refused");
+	std::cerr.rdbuf(err);
+	return problems;
+}
+int checkAllocators() {
+	//returns the number of engine and backing combinations that failed
+	int failures = 0;
+	std::cout << "ALLOCATOR CONFORMANCE:\n";
+	for (int k = 0; k < A_COUNT; k++)
+	{
+		for (int framed = 0; framed < 2; framed++)
+		{
+			FrameAccount account;
+			HeapAllocator* heap = makeHeapAllocator((AllocatorKind)k, 1 << 16, framed ? &account : nullptr);
+			std::cout << "  " << heap->getName() << (framed ? " (FRAMES)" : "") << ": ";
+			std::vector<std::string> problems = checkAllocator(heap);
+			delete heap;
+			if (account.used.load() != 0)
+				problems.push_back("frames not returned");
+			for (size_t i = 0; i < problems.size(); i++)
+				std::cout << (i ? ", " : "") << problems[i];
+			std::cout << (problems.empty() ? "ok" : "") << "\n";
+			failures += problems.empty() ? 0 : 1;
+		}
+	}
+	return failures;
+}
+void benchAllocators() {
+	const char* workloads[] = { "SMALL FIXED", "MIXED CHURN", "LIFO GROWTH" };
+	const int rounds = 2000;
+	for (int w = 0; w < 3; w++)
+	{
+		std::cout << "ALLOCATOR WORKLOAD " << workloads[w] << " (" << rounds << " ROUNDS):\n";
+		for (int k = 0; k < A_COUNT; k++)
+		{
+			AllocatorBenchResult r = benchAllocator((AllocatorKind)k, w, rounds);
+			std::cout << "  " << r.name << ": " << r.ms << " ms, " << r.failed << " failed, " << r.corrupt << " corrupt\n";
+		}
+	}
+}
+void benchReallocation() {
+	//vector-like growth: two arrays grown by 1.5x from 16 bytes up to 2048, either on their own or interleaved with short-lived allocations
+	const int rounds = 2000;
+	for (int interleaved = 0; interleaved < 2; interleaved++)
+	{
+		std::cout << "REALLOCATE VECTOR GROWTH" << (interleaved ? ", INTERLEAVED" : "") << " (" << rounds << " ROUNDS):\n";
+		for (int k = 0; k < A_COUNT; k++)
+		{
+			HeapAllocator* heap = makeHeapAllocator((AllocatorKind)k, DEFAULT_HEAP_SIZE);
+			int copies = 0, grows = 0, failed = 0;
+			std::streambuf* err = std::cerr.rdbuf(nullptr);
+			BenchTimer t;
+			for (int r = 0; r < rounds; r++)
+			{
+				int vecs[2] = { heap->allocate(16), heap->allocate(16) };
+				int sizes[2] = { 16, 16 };
+				bool ok = vecs[0] != -1 && vecs[1] != -1;
+				while (ok && sizes[0] < 2048)
+				{
+					for (int v = 0; v < 2 && ok; v++)
+					{
+						int temp = interleaved ? heap->allocate(24) : -1;
+						sizes[v] += sizes[v] >> 1;
+						int moved = heap->reallocate(vecs[v], sizes[v]);
+						grows++;
+						if (moved == -1) { failed++; ok = false; }
+						else if (moved != vecs[v]) copies++;
+						if (ok) vecs[v] = moved;
+						if (temp != -1) heap->deallocate(temp);
+					}
+				}
+				for (int v = 0; v < 2; v++)
+					if (vecs[v] != -1) heap->deallocate(vecs[v]);
+			}
+			double ms = t.elapsedMs();
+			std::cerr.rdbuf(err);
+			std::cout << "  " << heap->getName() << ": " << ms << " ms, " << copies << " copies out of " << grows << " grows, " << failed << " failed\n";
+			delete heap;
+		}
+	}
+}
+void benchCheckpoint() {
+	//a process with a 64 MB heap and a few thousand objects, rebuilt from scratch versus restored from a checkpoint
+	RuntimeLayout layout = RuntimeLayout::of<Layout64>();
+	layout.HEAP_SIZE = 1 << 26;
+	std::vector<int> objects;
+	BenchRandom rnd;
+	for (int i = 0; i < 4000; i++)
+		objects.push_back(16 + rnd.next(8000));
+	const char* path = "bench_checkpoint.bin";
+	std::cout << "CHECKPOINT (64 MB HEAP, " << objects.size() << " OBJECTS):\n";
+	for (int k = A_BUDDY; k <= A_TLSF; k++)
+	{
+		BenchProgram prog;
+		BenchTimer build;
+		AddressSpace* space = prog.build(layout, 4096, &objects, (AllocatorKind)k);
+		for (vaddr_t page = 0; page < (1 << 25); page += FRAME_SIZE)
+			memset(space->accessAddress(layout.DYNAMIC_START + (1 << 25) + page), 0x5a, FRAME_SIZE);//touch the upper half of the heap, as a running process would have (a page at a time, frames aren't contiguous). the objects sit below it, and the restore checks their headers
+		double build_ms = build.elapsedMs();
+		BenchTimer save;
+		space->saveCheckpoint(path);
+		double save_ms = save.elapsedMs();
+		BenchTimer restore;
+		AddressSpace* restored = AddressSpace::restoreCheckpoint(path);
+		double restore_ms = restore.elapsedMs();
+		int mismatched = 0;
+		vaddr_t probe = layout.DYNAMIC_START + (1 << 25) + (1 << 24);
+		if (restored == nullptr || *(char*)restored->accessAddress(probe) != *(char*)space->accessAddress(probe))
+			mismatched++;
+		std::cout << "  " << space->getHeap()->getName() << ": build " << build_ms << " ms, save " << save_ms << " ms, restore " << restore_ms << " ms"
+			<< (restored == nullptr ? " (RESTORE FAILED)" : mismatched ? " (HEAP MISMATCH)" : "") << "\n";
+		delete restored;
+		delete space;
+	}
+	std::remove(path);
+}
+void benchCompaction() {
+	//fill a 1 MB buddy heap with handle blocks, free a random half, then compact in 50us steps
+	DynamicRegion heap(1 << 20);
+	std::vector<int> handles;
+	BenchRandom rnd;
+	std::streambuf* err = std::cerr.rdbuf(nullptr);
+	int h;
+	while ((h = heap.allocateHandle(16 + rnd.next(2032))) != -1)
+		handles.push_back(h);
+	for (size_t i = 0; i < handles.size(); i++)
+		if (rnd.next(2) == 0)
+			heap.deallocateHandle(handles[i]);
+	int before = heap.largestFree();
+	bool large_before = heap.allocate(1 << 16) != -1;
+	double max_pause = 0, total = 0;
+	int calls = 0;
+	for (int pass = 0; pass < 3; pass++)
+	{
+		bool done = false;
+		while (!done)
+		{
+			BenchTimer t;
+			done = heap.compact(50);
+			double ms = t.elapsedMs();
+			total += ms;
+			max_pause = ms > max_pause ? ms : max_pause;
+			calls++;
+		}
+	}
+	int after = heap.largestFree();
+	bool large_after = heap.allocate(1 << 16) != -1;
+	std::cerr.rdbuf(err);
+	std::cout << "COMPACTION (1 MB BUDDY HEAP, " << handles.size() << " BLOCKS, HALF FREED):\n";
+	std::cout << "  largest free block " << before << " -> " << after << " bytes, 64 KB allocation " << (large_before ? "succeeded" : "failed")
+		<< " before and " << (large_after ? "succeeded" : "failed") << " after\n";
+	std::cout << "  " << calls << " compact calls over 3 passes, " << total << " ms total, longest pause " << max_pause << " ms\n";
+}
+void benchDiffDump() {
+	//a process with a 1 MB heap and 4000 objects, where each simulation step writes to 8 places, dumped in full versus as a diff
+	std::vector<int> objects(4000, 64);
+	BenchProgram prog;
+	AddressSpace* space = prog.build(Layout64(), 16384, &objects);
+	RuntimeLayout r = space->getLayout();
+	const int steps = 50;
+	std::ostringstream sink;
+	std::streambuf* out = std::cout.rdbuf(sink.rdbuf());
+	BenchRandom rnd;
+	double full_ms = 0, diff_ms = 0;
+	for (int mode = 0; mode < 2; mode++)
+	{
+		BenchTimer t;
+		for (int step = 0; step < steps; step++)
+		{
+			for (int w = 0; w < 8; w++)
+				*(char*)space->accessAddressForWrite(r.DYNAMIC_START + rnd.next(r.HEAP_SIZE)) = (char)step;
+			*(int*)((memsafe_data_entry*)space->accessAddressForWrite(r.BSS_START))->data = step;
+			if (mode == 0)
+				space->printAddressSpaceInfo();
+			else
+				space->printAddressSpaceDiff();
+			sink.str("");
+		}
+		(mode == 0 ? full_ms : diff_ms) = t.elapsedMs();
+	}
+	std::cout.rdbuf(out);
+	std::cout << "DUMP (" << steps << " STEPS, 1 MB HEAP, 4000 OBJECTS, 9 WRITES PER STEP):\n";
+	std::cout << "  full dump " << full_ms << " ms, diff dump " << diff_ms << " ms\n";
+	delete space;
+}
+void benchBatchAllocation() {
+	//thousands of initial heap objects, as a process declared with a long dynamic list would have
+	std::vector<int> objects;
+	BenchRandom rnd;
+	for (int i = 0; i < 20000; i++)
+		objects.push_back(8 + rnd.next(120));
+	DynamicRegion sequential(1 << 22), batched(1 << 22);
+	BenchTimer seq_t;
+	std::vector<int> seq_offsets;
+	for (int size : objects)
+		seq_offsets.push_back(sequential.allocate(size));
+	double seq_ms = seq_t.elapsedMs();
+	BenchTimer batch_t;
+	std::vector<int> batch_offsets = batched.allocateBatch(objects.data(), (int)objects.size());
+	double batch_ms = batch_t.elapsedMs();
+	std::cout << "BATCH ALLOCATION (" << objects.size() << " OBJECTS, 4 MB BUDDY HEAP):\n";
+	std::cout << "  sequential " << seq_ms << " ms, batched " << batch_ms << " ms, placement " << (seq_offsets == batch_offsets ? "identical" : "DIFFERENT") << "\n";
+}
+void benchProfiler() {
+#ifdef PROFILE_ACCESSES
+	//skewed accesses: most land in one 4 KB stretch of the heap, the rest are spread over the heap and text
+	const int rounds = 2000000;
+	const int runs = 40;
+	BenchProgram prog;
+	AddressSpace* space = prog.build(Layout64(), 16384);
+	RuntimeLayout r = space->getLayout();
+	std::vector<vaddr_t> addresses;
+	BenchRandom rnd;
+	for (int i = 0; i < 4096; i++)
+	{
+		int pick = rnd.next(10);
+		addresses.push_back(pick < 8 ? r.DYNAMIC_START + 65536 + rnd.next(4096) : pick == 8 ? r.DYNAMIC_START + rnd.next(r.HEAP_SIZE) : r.TEXT_START + rnd.next(16384));
+	}
+	double ms[2] = { 1e30, 1e30 };
+	unsigned long long sink = 0;
+	for (int run = 0; run < runs; run++)
+	{
+		//many short runs, alternated, keeping the best of each, so noise from the machine doesn't show up as overhead
+		int enabled = run & 1;
+		if (enabled)
+			space->enableProfiling(64);
+		else
+			space->disableProfiling();
+		BenchTimer t;
+		for (int i = 0; i < rounds; i++)
+			sink += (unsigned long long)space->accessAddress(addresses[i & 4095]);
+		double elapsed = t.elapsedMs();
+		ms[enabled] = elapsed < ms[enabled] ? elapsed : ms[enabled];
+	}
+	if (sink == 1) std::cout << "";
+	std::cout << "ACCESS PROFILER (" << runs / 2 << " x " << rounds << " ACCESSES EACH WAY, 1 IN 64 SAMPLED):\n";
+	std::cout << "  disabled " << ms[0] << " ms, enabled " << ms[1] << " ms (" << (ms[1] / ms[0] - 1) * 100 << "% overhead)\n";
+	space->printAccessProfile(5);
+	delete space;
+#else
+	std::cout << "ACCESS PROFILER: compiled out, rebuild with -DPROFILE_ACCESSES\n";
+#endif
+}
+void benchFramePool() {
+	//every thread is a process with its own account, taking frames in bursts and handing them back, against new/delete of a page as the baseline
+	const int threads = 8;
+	const int rounds = 20000;
+	const int burst = 64;
+	FramePool pool(threads * burst * 2);
+	std::vector<FrameAccount> accounts(threads);
+	accounts[0].quota = burst / 2;//one process is given half of what it asks for
+	std::vector<std::thread> workers;
+	BenchTimer pool_t;
+	for (int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]() {
+			int frames[burst];
+			for (int r = 0; r < rounds; r++)
+			{
+				int got = 0;
+				for (int i = 0; i < burst; i++)
+					if ((frames[got] = pool.allocateFrame(&accounts[t])) != -1)
+						got++;
+				for (int i = 0; i < got; i++)
+					pool.freeFrame(frames[i], &accounts[t]);
+			}
+		});
+	}
+	for (std::thread& w : workers)
+		w.join();
+	double pool_ms = pool_t.elapsedMs();
+	workers.clear();
+	BenchTimer heap_t;
+	for (int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&]() {
+			char* frames[burst];
+			for (int r = 0; r < rounds; r++)
+			{
+				for (int i = 0; i < burst; i++)
+					frames[i] = new char[FRAME_SIZE];
+				for (int i = 0; i < burst; i++)
+					delete[] frames[i];
+			}
+		});
+	}
+	for (std::thread& w : workers)
+		w.join();
+	double heap_ms = heap_t.elapsedMs();
+	double ops = 2.0 * threads * rounds * burst;
+	std::cout << "FRAME POOL (" << threads << " THREADS, " << burst << " FRAME BURSTS):\n";
+	std::cout << "  pool " << pool_ms << " ms (" << ops / pool_ms / 1000 << " M ops/s), new/delete " << heap_ms << " ms (" << ops / heap_ms / 1000 << " M ops/s)\n";
+	std::cout << "  quota " << accounts[0].quota << ": peak " << accounts[0].peak.load() << ", " << accounts[0].denied.load() << " denied, "
+		<< pool.getFreeCount() << " of " << pool.getFrameCount() << " frames back on the shared stack\n";
+	//reclaim: a process that touched 32 MB of heap going away
+	RuntimeLayout layout = RuntimeLayout::of<Layout64>();
+	layout.HEAP_SIZE = 1 << 26;
+	BenchProgram prog;
+	AddressSpace* space = prog.build(layout);
+	for (vaddr_t page = 0; page < (1 << 25); page += FRAME_SIZE)
+		*(char*)space->accessAddressForWrite(layout.DYNAMIC_START + page) = 1;
+	int held = space->getFrameAccount().used.load();
+	int before = FramePool::global().getFreeCount();
+	BenchTimer reclaim_t;
+	delete space;
+	double reclaim_ms = reclaim_t.elapsedMs();
+	std::cout << "  reclaimed " << FramePool::global().getFreeCount() - before << " of " << held << " frames in " << reclaim_ms << " ms\n";
+}
+void benchSuperpages() {
+	//a 24 MB heap block and 8 MB of text, accessed at random: far beyond what 64 base page entries reach, well within 32 superpage entries
+	const int rounds = 4000000;
+	RuntimeLayout layout = RuntimeLayout::of<Layout64>();
+	layout.HEAP_SIZE = 1 << 26;
+	std::vector<int> objects = { 24 << 20, 8 << 20, 900, 50 };
+	BenchProgram prog;
+	AddressSpace* space = prog.build(layout, 8 << 20, &objects);
+	std::vector<vaddr_t> addresses;
+	BenchRandom rnd;
+	for (int i = 0; i < 65536; i++)
+	{
+		int pick = rnd.next(20);
+		addresses.push_back(pick < 14 ? layout.DYNAMIC_START + rnd.next(16 << 20) : pick < 19 ? layout.TEXT_START + rnd.next(8 << 20) : layout.stackAddress(rnd.next(4)));
+	}
+	space->enableTlb();
+	std::cout << "SUPERPAGES (" << rounds << " ACCESSES OVER 16 MB OF HEAP AND 8 MB OF TEXT, 64 + 32 ENTRY TLB):\n";
+	unsigned long long sink = 0;
+	for (int enabled = 0; enabled < 2; enabled++)
+	{
+		space->setSuperpages(enabled != 0);
+		space->getTlb()->resetCounts();
+		for (int i = 0; i < rounds; i++)
+			sink += (unsigned long long)space->accessAddress(addresses[i & 65535]);
+		TlbModel* tlb = space->getTlb();
+		std::cout << "  " << (enabled ? "superpages" : "base pages") << ": " << space->getSuperpageCount() << " superpages, reach " << (tlb->getReach() >> 10)
+			<< " KB, " << tlb->getMisses() << " misses, miss rate " << tlb->getMissRate() * 100 << "%\n";
+	}
+	if (sink == 1) std::cout << "";
+	vaddr_t large = layout.DYNAMIC_START;//the buddy engine places the 24 MB block in the first 32 MB and the 8 MB block right after it
+	vaddr_t medium = layout.DYNAMIC_START + (32 << 20);
+	int before = space->getSuperpageCount();
+	space->deallocate(large);
+	int after_free = space->getSuperpageCount();
+	space->reallocate(medium, 16 << 20);
+	std::cout << "  superpages " << before << " -> " << after_free << " after freeing the 24 MB block -> " << space->getSuperpageCount()
+		<< " after growing the 8 MB block to 16 MB\n";
+	delete space;
+}
+int runBenchmarks() {
+	//returns the number of conformance failures, the timings themselves can't fail
+	benchLayouts();
+	int failures = checkAllocators();
+	benchAllocators();
+	benchReallocation();
+	benchCheckpoint();
+	benchCompaction();
+	benchDiffDump();
+	benchBatchAllocation();
+	benchProfiler();
+	benchFramePool();
+	benchSuperpages();
+	return failures;
+}
 int main(int argc, const char* argv[]) {
 	/*
 	In this example, we assume that program 1 contains all the shared data (text, bss, data), so we do not copy the data and text regions from programs 2 and 3
@@ -853,11 +3958,15 @@ int main(int argc, const char* argv[]) {
 	*/
 	
 	//test.printAddressSpaceInfo();
+	if (argc == 2 && std::string(argv[1]) == "--bench")
+	{
+		return runBenchmarks() == 0 ? 0 : 1;
+	}
 	if (argc != 1)
 	{
 		if (argc != 4)
 		{
-			std::cout << "Error: please specify 3 .txt files to be loaded\n";
+			std::cout << "Error: please specify 3 .txt files to be loaded (or --bench to run the benchmarks)\n";
 			return 0;
 		}
 		AddressSpace *prog1, *prog2, *prog3;